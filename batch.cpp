@@ -0,0 +1,265 @@
+// This file runs one script over many files in parallel:
+//
+//     praat-py --jobs N script.praatpy [--] file1 file2 ...
+//
+// Praat (and Python) are initialized once, then N worker processes are
+// forked, which take files from a shared queue and run the script with
+// argv = [script, file]. Each run's Info window output and errors go to
+// files of their own, which are copied to our stdout and stderr in the
+// order of the files on the command line once all workers are done.
+
+#include <stdio.h>
+#include <wchar.h>
+
+#include "../sys/melder.h"
+#include "../sys/praatP.h"
+#include "../sys/praat_script.h"
+
+#include "scripting.h"
+
+int scripting_batchWorker = 0;
+
+#if defined (_WIN32)
+
+extern "C" int scripting_runBatchJobs (wchar_t **argv, int *exitCode) {
+	if (argv == NULL || argv [0] == NULL || wcscmp (argv [0], L"--jobs") != 0)
+		return 0;
+	fprintf (stderr, "praat-py: --jobs is not available on Windows.\n");
+	*exitCode = 1;
+	return 1;
+}
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define JOB_WAITING 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_FAILED 3
+#define JOB_CRASHED 4
+
+typedef struct {
+	long next;   // the next file to hand out
+	long current [1];   // per worker, the file it is working on or -1; really [numberOfWorkers]
+} BatchQueue;
+
+static const char *theDirectory;
+
+static void job_file_name (char *path, size_t size, long ifile, const char *suffix) {
+	snprintf (path, size, "%s/%ld.%s", theDirectory, ifile, suffix);
+}
+
+static int redirect (int fd, long ifile, const char *suffix) {
+	char path [1000];
+	job_file_name (path, sizeof path, ifile, suffix);
+	int out = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (out == -1)
+		return -1;
+	dup2 (out, fd);
+	close (out);
+	return 0;
+}
+
+static void worker (int iworker, BatchQueue *queue, char *status, long numberOfFiles, wchar_t *script, wchar_t **files) {
+	int savedStdout = dup (1), savedStderr = dup (2);
+	scripting_batchWorker = 1;   // so that sys.exit() ends the job, not the worker
+	for (;;) {
+		long ifile = __sync_fetch_and_add (& queue -> next, 1);
+		if (ifile >= numberOfFiles)
+			break;
+		queue -> current [iworker] = ifile;
+		status [ifile] = JOB_RUNNING;
+
+		fflush (stdout);
+		fflush (stderr);
+		if (redirect (1, ifile, "out") == -1 || redirect (2, ifile, "err") == -1) {
+			dup2 (savedStdout, 1);
+			dup2 (savedStderr, 2);
+			status [ifile] = JOB_FAILED;
+			queue -> current [iworker] = -1;
+			continue;
+		}
+
+		const wchar_t *argv [3] = { script, files [ifile], NULL };
+		structMelderFile file = { 0 };
+		try {
+			Melder_relativePathToFile (script, & file);
+			praat_executeScriptFromFile2 (& file, NULL, argv);
+			status [ifile] = JOB_DONE;
+		} catch (MelderError) {
+			Melder_flushError (NULL);
+			status [ifile] = JOB_FAILED;
+		}
+
+		fflush (stdout);
+		fflush (stderr);
+		dup2 (savedStdout, 1);
+		dup2 (savedStderr, 2);
+		queue -> current [iworker] = -1;
+	}
+	_exit (0);
+}
+
+static pid_t start_worker (int iworker, BatchQueue *queue, char *status, long numberOfFiles, wchar_t *script, wchar_t **files) {
+	fflush (stdout);
+	fflush (stderr);
+	pid_t pid = fork ();
+	if (pid == 0)
+		worker (iworker, queue, status, numberOfFiles, script, files);
+	return pid;
+}
+
+static void copy_output (long ifile, const char *suffix, FILE *to) {
+	char path [1000], buffer [65536];
+	job_file_name (path, sizeof path, ifile, suffix);
+	FILE *from = fopen (path, "rb");
+	if (from) {
+		size_t n;
+		while ((n = fread (buffer, 1, sizeof buffer, from)) > 0)
+			fwrite (buffer, 1, n, to);
+		fclose (from);
+	}
+	unlink (path);
+}
+
+extern "C" int scripting_runBatchJobs (wchar_t **argv, int *exitCode) {
+	// argv is the command line starting from "--jobs". Returns 0 if this is
+	// not a --jobs command line, so that the caller runs the script in the
+	// usual way. Otherwise returns 1 after running all the jobs, with
+	// exitCode set to 1 if any of them failed.
+	if (argv == NULL || argv [0] == NULL || wcscmp (argv [0], L"--jobs") != 0)
+		return 0;
+
+	*exitCode = 1;
+	int numberOfWorkers = argv [1] ? wcstol (argv [1], NULL, 10) : 0;
+	wchar_t *script = argv [1] ? argv [2] : NULL;
+	if (numberOfWorkers < 1 || script == NULL) {
+		fprintf (stderr, "praat-py: usage: praat-py --jobs N script [--] file1 file2 ...\n");
+		return 1;
+	}
+	wchar_t **files = argv + 3;
+	if (*files && wcscmp (*files, L"--") == 0)
+		files ++;
+	long numberOfFiles = 0;
+	while (files [numberOfFiles])
+		numberOfFiles ++;
+	if (numberOfFiles == 0) {
+		*exitCode = 0;
+		return 1;
+	}
+	if (numberOfWorkers > numberOfFiles)
+		numberOfWorkers = numberOfFiles;
+
+	// Short enough to leave room for the file names in job_file_name.
+	char directory [900];
+	const char *tmp = getenv ("TMPDIR");
+	if (tmp == NULL || tmp [0] == '\0')
+		tmp = "/tmp";
+	if (snprintf (directory, sizeof directory, "%s/praat-py-jobs-XXXXXX", tmp) >= (int) sizeof directory) {
+		fprintf (stderr, "praat-py: the directory name in TMPDIR is too long\n");
+		return 1;
+	}
+	if (mkdtemp (directory) == NULL) {
+		perror ("praat-py: cannot create a directory for the job output");
+		return 1;
+	}
+	theDirectory = directory;
+
+	// The queue and the status of each file are shared with the workers.
+	size_t queueSize = sizeof (BatchQueue) + numberOfWorkers * sizeof (long);
+	size_t sharedSize = queueSize + numberOfFiles;
+	void *shared = mmap (NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror ("praat-py: cannot set up the job queue");
+		rmdir (directory);
+		return 1;
+	}
+	BatchQueue *queue = (BatchQueue *) shared;
+	char *status = (char *) shared + queueSize;
+	queue -> next = 0;
+	for (int iworker = 0; iworker < numberOfWorkers; iworker ++)
+		queue -> current [iworker] = -1;
+	memset (status, JOB_WAITING, numberOfFiles);
+
+	// Start Python now, so that the workers don't each have to.
+	scripting_start_python ();
+
+	pid_t *pids = (pid_t *) calloc (numberOfWorkers, sizeof (pid_t));
+	if (pids == NULL) {
+		fprintf (stderr, "praat-py: out of memory for the workers\n");
+		munmap (shared, sharedSize);
+		rmdir (directory);
+		return 1;
+	}
+	int running = 0;
+	for (int iworker = 0; iworker < numberOfWorkers; iworker ++) {
+		pids [iworker] = start_worker (iworker, queue, status, numberOfFiles, script, files);
+		if (pids [iworker] > 0)
+			running ++;
+	}
+
+	while (running > 0) {
+		int wstatus;
+		pid_t pid = wait (& wstatus);
+		if (pid == -1)
+			break;
+		int iworker = 0;
+		while (iworker < numberOfWorkers && pids [iworker] != pid)
+			iworker ++;
+		if (iworker == numberOfWorkers)
+			continue;
+		running --;
+		pids [iworker] = 0;
+
+		// A worker that dies, or leaves in the middle of a file, takes only
+		// its current file down with it; another worker takes its place for
+		// the rest of the queue.
+		long ifile = queue -> current [iworker];
+		if (! WIFEXITED (wstatus) || WEXITSTATUS (wstatus) != 0 || ifile >= 0) {
+			if (ifile >= 0)
+				status [ifile] = JOB_CRASHED;
+			queue -> current [iworker] = -1;
+			if (queue -> next < numberOfFiles) {
+				pids [iworker] = start_worker (iworker, queue, status, numberOfFiles, script, files);
+				if (pids [iworker] > 0)
+					running ++;
+			}
+		}
+	}
+	free (pids);
+
+	// Merge the output in the order of the files, then list the failures.
+	long numberOfFailures = 0;
+	for (long ifile = 0; ifile < numberOfFiles; ifile ++) {
+		copy_output (ifile, "out", stdout);
+		copy_output (ifile, "err", stderr);
+		if (status [ifile] != JOB_DONE)
+			numberOfFailures ++;
+	}
+	fflush (stdout);
+	if (numberOfFailures > 0) {
+		fprintf (stderr, "praat-py: %ld of %ld files failed:\n", numberOfFailures, numberOfFiles);
+		for (long ifile = 0; ifile < numberOfFiles; ifile ++) {
+			if (status [ifile] == JOB_DONE)
+				continue;
+			fprintf (stderr, "   %ls (%s)\n", files [ifile],
+				status [ifile] == JOB_FAILED ? "script error" :
+				status [ifile] == JOB_CRASHED ? "worker crashed" : "not run");
+		}
+	}
+
+	munmap (shared, sharedSize);
+	rmdir (directory);
+	*exitCode = numberOfFailures > 0;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+# Helpers for the .praatpy benchmarks run by run.py.
+#
+# Each benchmark times its operations one at a time and prints one line
+# "@lat <microseconds>" per operation, which run.py collects. The native
+# .praat versions print the same lines.
+
+import time
+
+def ops(default):
+	# The number of operations to run, given on the command line by run.py.
+	import praat
+	return int(praat.argv[1]) if len(praat.argv) > 1 else default
+
+def measure(n, op):
+	# Run op(i) for i in 0..n-1 and report how long each call took.
+	clock = time.time
+	latencies = []
+	for i in xrange(n):
+		start = clock()
+		op(i)
+		latencies.append(clock() - start)
+	print "\n".join(["@lat %.3f" % (t * 1e6) for t in latencies])
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+"""Runs the praat-py benchmarks and their native Praat counterparts.
+
+    python bench/run.py [--praat PATH] [--scale X] [case ...]
+
+Each case is a pair of scripts, case.praatpy and case.praat, which time
+their operations one at a time (see benchlib.py). Both are run headless
+with the given praat-py binary (default ../praat, as built by "make
+praat"), and one JSON object per case and implementation is written to
+stdout:
+
+    {"case": "getnum", "impl": "praat-py", "ops": 20000,
+     "ops_per_sec": ..., "p50_us": ..., "p99_us": ..., "wall_s": ...}
+
+ops_per_sec counts only the time inside the timed operations. A summary
+for people goes to stderr. --scale multiplies the number of operations
+of every case, e.g. 0.1 for a quick run.
+"""
+
+import json
+import os
+import subprocess
+import sys
+import time
+
+CASES = [
+	("go", 20000),
+	("getnum", 20000),
+	("dispatch", 20000),
+	("select", 200),
+	("print", 50000),
+	("resample", 50),
+]
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def percentile(values, p):
+	# Nearest-rank percentile of a sorted list.
+	k = max(0, min(len(values) - 1, int(round(p / 100.0 * len(values) + 0.5)) - 1))
+	return values[k]
+
+
+def run(praat, case, impl, ops):
+	script = case + (".praatpy" if impl == "praat-py" else ".praat")
+	start = time.time()
+	process = subprocess.Popen([praat, script, str(ops)], cwd=HERE,
+		stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+	out, err = process.communicate()
+	wall = time.time() - start
+	latencies = sorted(float(line.split()[1]) for line in out.decode("utf-8", "replace").splitlines()
+		if line.startswith("@lat "))
+	result = {"case": case, "impl": impl}
+	if process.returncode != 0 or len(latencies) != ops:
+		result["error"] = err.decode("utf-8", "replace").strip()[-500:] or \
+			"exit status %d, %d of %d operations" % (process.returncode, len(latencies), ops)
+		return result
+	result.update({
+		"ops": ops,
+		"ops_per_sec": round(ops / (sum(latencies) / 1e6), 1),
+		"p50_us": percentile(latencies, 50),
+		"p99_us": percentile(latencies, 99),
+		"wall_s": round(wall, 3),
+	})
+	return result
+
+
+def main(argv):
+	praat = os.path.join(HERE, "..", "..", "praat")
+	scale = 1.0
+	names = []
+	args = list(argv)
+	while args:
+		arg = args.pop(0)
+		if arg == "--praat":
+			praat = args.pop(0)
+		elif arg == "--scale":
+			scale = float(args.pop(0))
+		else:
+			names.append(arg)
+	praat = os.path.abspath(praat)
+	cases = [(name, ops) for name, ops in CASES if not names or name in names]
+
+	failed = False
+	for case, ops in cases:
+		ops = max(1, int(ops * scale))
+		results = {}
+		for impl in ("praat-py", "praat"):
+			result = run(praat, case, impl, ops)
+			results[impl] = result
+			print(json.dumps(result, sort_keys=True))
+			sys.stdout.flush()
+			if "error" in result:
+				failed = True
+				sys.stderr.write("%-9s %-9s failed: %s\n" % (case, impl, result["error"]))
+			else:
+				sys.stderr.write("%-9s %-9s %12.1f ops/s   p50 %9.1f us   p99 %9.1f us\n" % (
+					case, impl, result["ops_per_sec"], result["p50_us"], result["p99_us"]))
+		if "error" not in results["praat-py"] and "error" not in results["praat"]:
+			sys.stderr.write("%-9s praat-py runs at %.2fx the speed of the native script\n" % (
+				case, results["praat-py"]["ops_per_sec"] / results["praat"]["ops_per_sec"]))
+	return 1 if failed else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,103 @@
+/* Times the UTF-8/wchar_t conversions in transcode.c against the C library's
+ * mbsrtowcs and wcsrtombs in a UTF-8 locale.
+ *
+ *     make bench-transcode
+ *
+ * The cases are short command lines (ascii), a long run of ASCII output
+ * (info), and phonetic labels in IPA, mostly non-ASCII (ipa). For each case,
+ * direction and implementation one JSON object is written to stdout, like
+ * bench/run.py does:
+ *
+ *     {"case": "info", "direction": "to_wcs", "impl": "transcode",
+ *      "bytes": ..., "MB_per_sec": ...}
+ *
+ * MB_per_sec counts the UTF-8 bytes converted in either direction. */
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "../transcode.h"
+
+#define TOTAL_BYTES (64 * 1024 * 1024)   // converted per case, direction and implementation
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *repeat(const char *piece, size_t length) {
+	// piece over and over, cut to length bytes at a character boundary.
+	size_t n = strlen(piece);
+	char *text = (char*)malloc(length + n + 1);
+	size_t used = 0;
+	while (used < length) {
+		memcpy(text + used, piece, n);
+		used += n;
+	}
+	text[used] = 0;
+	return text;
+}
+
+static void report(const char *name, const char *direction, const char *impl, size_t bytes, double seconds) {
+	printf("{\"MB_per_sec\": %.1f, \"bytes\": %lu, \"case\": \"%s\", \"direction\": \"%s\", \"impl\": \"%s\"}\n",
+		bytes / seconds / 1e6, (unsigned long)bytes, name, direction, impl);
+	fflush(stdout);
+}
+
+static void run(const char *name, const char *utf8, int haveLocale) {
+	size_t bytes = strlen(utf8), length = transcode_wcsLength(utf8, bytes);
+	long rounds = TOTAL_BYTES / bytes + 1, i;
+	wchar_t *wc = (wchar_t*)malloc((bytes + 1) * sizeof(wchar_t));
+	char *back = (char*)malloc(4 * length + 1);
+	double start;
+
+	start = now();
+	for (i = 0; i < rounds; i++)
+		transcode_fromUtf8(wc, utf8, bytes);
+	report(name, "to_wcs", "transcode", bytes, (now() - start) / rounds);
+
+	start = now();
+	for (i = 0; i < rounds; i++)
+		transcode_toUtf8(back, wc, length);
+	report(name, "to_utf8", "transcode", bytes, (now() - start) / rounds);
+	if (strcmp(back, utf8) != 0)
+		fprintf(stderr, "%s: the text does not come back the same.\n", name);
+
+	if (haveLocale) {
+		start = now();
+		for (i = 0; i < rounds; i++) {
+			const char *src = utf8;
+			mbsrtowcs(wc, &src, bytes + 1, NULL);
+		}
+		report(name, "to_wcs", "libc", bytes, (now() - start) / rounds);
+
+		start = now();
+		for (i = 0; i < rounds; i++) {
+			const wchar_t *src = wc;
+			wcsrtombs(back, &src, 4 * length + 1, NULL);
+		}
+		report(name, "to_utf8", "libc", bytes, (now() - start) / rounds);
+	}
+
+	free(wc);
+	free(back);
+}
+
+int main() {
+	int haveLocale = setlocale(LC_CTYPE, "C.UTF-8") != NULL || setlocale(LC_CTYPE, "en_US.UTF-8") != NULL;
+	char *info = repeat("1\t0.0123\t118.25 Hz\tsentence one\n", 1 << 20);
+	char *ipa = repeat("\xca\x83\xc9\x99\xcb\x88l\xc9\x91\xcb\x90\xc5\x8b \xce\xb8\xc9\xaa\xc5\x8b\xcb\x90 ", 1 << 16);
+	if (!haveLocale)
+		fprintf(stderr, "There is no UTF-8 locale, so the C library is not timed.\n");
+	run("ascii", "To Pitch... 0 75 600", haveLocale);
+	run("info", info, haveLocale);
+	run("ipa", ipa, haveLocale);
+	free(info);
+	free(ipa);
+	return 0;
+}
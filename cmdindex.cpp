@@ -0,0 +1,168 @@
+// This file keeps a hash index of Praat's commands by title, so that
+// looking up the command for a line of a script doesn't have to compare
+// the title against each of the thousands of actions and menu commands.
+//
+// praat_doAction and praat_doMenuCommand (see praat-py.patch) and our own
+// go() and prepare() look commands up here. Of the commands with a given
+// title, the one to run is the first that is executable, which is how
+// Praat records whether a command applies to the types of the selected
+// objects, so each title leads to the short list of commands with that
+// title, in Praat's order, and the first executable one is taken.
+//
+// The index is built the first time it is needed. Adding or removing an
+// action or menu command changes the count and reorders the tables, so
+// the index is rebuilt when the count has changed or a title no longer
+// matches. The index keeps its own copies of the titles, as a removed
+// command's title is freed. If there is no memory for the index, commands
+// are looked up by going through the table as Praat does.
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "../sys/melder.h"
+#include "../sys/praatP.h"
+
+#include "scripting.h"
+
+typedef struct {
+	long count;   // the number of commands when the index was built, or -1
+	long size;   // the number of slots, a power of two
+	wchar_t **titles;   // [size] a copy of the title in each slot, or NULL
+	long *slots;   // [size] the first command with that title
+	long *next;   // [1..count] the next command with the same title, or 0
+	praat_Command (*get) (long i);
+	long (*getCount) ();
+	int objectsWindowOnly;
+} CommandIndex;
+
+static CommandIndex theActionIndex = { -1, 0, NULL, NULL, NULL, praat_getAction, praat_getNumberOfActions, 0 };
+static CommandIndex theMenuCommandIndex = { -1, 0, NULL, NULL, NULL, praat_getMenuCommand, praat_getNumberOfMenuCommands, 1 };
+
+static unsigned long hash_title (const wchar_t *title) {
+	// FNV-1a over the characters of the title.
+	unsigned long hash = 2166136261UL;
+	for (; *title; title ++) {
+		hash ^= (unsigned long) *title;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+static int indexed (CommandIndex *me, praat_Command entry) {
+	// praat_executeCommand only runs fixed menu commands that are in the
+	// Objects or Picture window.
+	if (entry->title == NULL || entry->callback == NULL)
+		return 0;
+	if (me->objectsWindowOnly)
+		return entry->window && (wcscmp (entry->window, L"Objects") == 0 || wcscmp (entry->window, L"Picture") == 0);
+	return 1;
+}
+
+static void clear (CommandIndex *me) {
+	if (me->titles)
+		for (long slot = 0; slot < me->size; slot ++)
+			free (me->titles [slot]);
+	free (me->titles);
+	free (me->slots);
+	free (me->next);
+	me->titles = NULL;
+	me->slots = NULL;
+	me->next = NULL;
+	me->size = 0;
+	me->count = -1;
+}
+
+static int build (CommandIndex *me) {
+	// Returns 0, leaving the index unbuilt, if there is no memory.
+	long count = me->getCount ();
+	long size = 64;
+	while (size < 2 * count)
+		size *= 2;
+	clear (me);
+	me->titles = (wchar_t **) calloc (size, sizeof (wchar_t *));
+	me->slots = (long *) calloc (size, sizeof (long));
+	me->next = (long *) calloc (count + 1, sizeof (long));
+	me->size = size;
+	if (! me->titles || ! me->slots || ! me->next) {
+		clear (me);
+		return 0;
+	}
+
+	// Go through the commands backwards, so that each is put in front of
+	// the later ones with the same title and Praat's order is kept.
+	for (long i = count; i >= 1; i --) {
+		praat_Command entry = me->get (i);
+		if (! indexed (me, entry))
+			continue;
+		unsigned long slot = hash_title (entry->title) & (size - 1);
+		while (me->titles [slot] && wcscmp (me->titles [slot], entry->title) != 0)
+			slot = (slot + 1) & (size - 1);
+		if (! me->titles [slot] && ! (me->titles [slot] = wcsdup (entry->title))) {
+			clear (me);
+			return 0;
+		}
+		me->next [i] = me->slots [slot];
+		me->slots [slot] = i;
+	}
+	me->count = count;
+	return 1;
+}
+
+static long scan (CommandIndex *me, const wchar_t *title) {
+	// The lookup without the index.
+	long count = me->getCount ();
+	for (long i = 1; i <= count; i ++) {
+		praat_Command entry = me->get (i);
+		if (indexed (me, entry) && entry->executable && wcscmp (entry->title, title) == 0)
+			return i;
+	}
+	return 0;
+}
+
+static long look_up (CommandIndex *me, const wchar_t *title) {
+	// Returns the position of the first executable command with this
+	// title, or 0 if there is none.
+	for (int attempt = 0; attempt < 2; attempt ++) {
+		if (me->count != me->getCount () && ! build (me))
+			return scan (me, title);
+		unsigned long slot = hash_title (title) & (me->size - 1);
+		while (me->titles [slot] && wcscmp (me->titles [slot], title) != 0)
+			slot = (slot + 1) & (me->size - 1);
+		if (me->titles [slot] == NULL)
+			return 0;
+		int stale = 0;
+		for (long i = me->slots [slot]; i != 0; i = me->next [i]) {
+			praat_Command entry = me->get (i);
+			if (entry->title == NULL || wcscmp (entry->title, title) != 0) {
+				stale = 1;
+				break;
+			}
+			if (entry->executable)
+				return i;
+		}
+		if (! stale)
+			return 0;
+		me->count = -1;   // rebuild and try once more
+	}
+	return 0;
+}
+
+extern "C" long scripting_findAction (const wchar_t *title) {
+	scripting_profilePhase (SCRIPTING_PROFILE_LOOKUP);
+	long i = look_up (& theActionIndex, title);
+	scripting_profilePhase (SCRIPTING_PROFILE_RUN);
+	return i;
+}
+
+extern "C" long scripting_findMenuCommand (const wchar_t *title) {
+	scripting_profilePhase (SCRIPTING_PROFILE_LOOKUP);
+	long i = look_up (& theMenuCommandIndex, title);
+	scripting_profilePhase (SCRIPTING_PROFILE_RUN);
+	return i;
+}
+
+extern "C" void scripting_invalidateCommandIndex () {
+	theActionIndex. count = -1;
+	theMenuCommandIndex. count = -1;
+}
@@ -0,0 +1,192 @@
+// This file keeps the compiled code of Python scripts, so that a script
+// that is run again and again (by --jobs, sendpraat or a button) is only
+// compiled the first time.
+//
+// Code objects are looked up by the SHA-1 of the script's text. They are
+// kept in memory for as long as the interpreter lives, and written to a
+// cache directory as a file named after the hash holding the Python magic
+// number (which changes with the bytecode format) followed by the marshalled
+// code object. The directory is $PRAATPY_CACHE_DIR, or else praat-py in
+// $XDG_CACHE_HOME, ~/.cache or (on Windows) %LOCALAPPDATA%. Setting
+// PRAATPY_CACHE_DIR to an empty string turns off the files; the in-memory
+// cache is always used. Files are written to a temporary name first and
+// renamed, so that --jobs workers never read half a file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#if defined (_WIN32)
+	#include <direct.h>
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+#define PY_SSIZE_T_CLEAN   // the length passed with "s#" is a Py_ssize_t
+#include <Python.h>
+#include <marshal.h>
+
+#include "codecache.h"
+
+#define MAX_CACHED_SCRIPTS 64
+
+static PyObject *memory = NULL;   // {hash: code object}
+static PyObject *sha1 = NULL;   // hashlib.sha1
+static long hits = 0, loads = 0, compiles = 0;
+
+static int cache_directory(char *path, size_t size) {
+	// Put the cache directory in path, creating it if needed. Returns 0 if
+	// there is to be no cache on disk.
+	const char *dir = getenv("PRAATPY_CACHE_DIR");
+	if (dir) {
+		if (!*dir)
+			return 0;
+		snprintf(path, size, "%s", dir);
+	} else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+		snprintf(path, size, "%s/praat-py", dir);
+	#if defined (_WIN32)
+	} else if ((dir = getenv("LOCALAPPDATA")) && *dir) {
+		snprintf(path, size, "%s\\praat-py", dir);
+	#else
+	} else if ((dir = getenv("HOME")) && *dir) {
+		snprintf(path, size, "%s/.cache", dir);
+		mkdir(path, 0755);
+		snprintf(path, size, "%s/.cache/praat-py", dir);
+	#endif
+	} else {
+		return 0;
+	}
+	#if defined (_WIN32)
+		if (_mkdir(path) == -1 && errno != EEXIST)
+			return 0;
+	#else
+		if (mkdir(path, 0755) == -1 && errno != EEXIST)
+			return 0;
+	#endif
+	return 1;
+}
+
+static PyObject *script_hash(const char *source, size_t length) {
+	// The hex SHA-1 of the source, as a Python string.
+	PyObject *hash, *ret;
+	if (!sha1) {
+		PyObject *hashlib = PyImport_ImportModule("hashlib");
+		if (!hashlib)
+			return NULL;
+		sha1 = PyObject_GetAttrString(hashlib, "sha1");
+		Py_DECREF(hashlib);
+		if (!sha1)
+			return NULL;
+	}
+	if (!(hash = PyObject_CallFunction(sha1, "s#", source, (Py_ssize_t)length)))
+		return NULL;
+	ret = PyObject_CallMethod(hash, "hexdigest", NULL);
+	Py_DECREF(hash);
+	return ret;
+}
+
+static PyObject *load(const char *path) {
+	// The code object in the cache file, or NULL (with no exception set)
+	// if there is none or it is for another version of Python.
+	PyObject *code;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (PyMarshal_ReadLongFromFile(f) != PyImport_GetMagicNumber()) {
+		fclose(f);
+		return NULL;
+	}
+	code = PyMarshal_ReadLastObjectFromFile(f);
+	fclose(f);
+	if (!code || !PyCode_Check(code)) {
+		PyErr_Clear();
+		Py_XDECREF(code);
+		return NULL;
+	}
+	return code;
+}
+
+static void save(const char *path, PyObject *code) {
+	char temporary [1100];
+	PyObject *data = PyMarshal_WriteObjectToString(code, Py_MARSHAL_VERSION);
+	FILE *f;
+
+	if (!data) {
+		PyErr_Clear();
+		return;
+	}
+	snprintf(temporary, sizeof temporary, "%s.%d", path, (int)getpid());
+	if ((f = fopen(temporary, "wb"))) {
+		int ok;
+		PyMarshal_WriteLongToFile(PyImport_GetMagicNumber(), f, Py_MARSHAL_VERSION);
+		ok = fwrite(PyString_AS_STRING(data), 1, PyString_GET_SIZE(data), f) == (size_t)PyString_GET_SIZE(data);
+		ok = fclose(f) == 0 && ok;
+		#if defined (_WIN32)
+			remove(path);   // rename doesn't replace files on Windows
+		#endif
+		if (!ok || rename(temporary, path) != 0)
+			remove(temporary);
+	}
+	Py_DECREF(data);
+}
+
+PyObject *codecache_compile(const char *source, size_t length) {
+	// A new reference to the code object for the script source, from the
+	// cache if it's there. Returns NULL with a Python exception set if the
+	// script doesn't compile.
+	char dir [1000], path [1050];
+	int onDisk;
+	PyObject *key, *code;
+
+	if (!memory && !(memory = PyDict_New()))
+		return NULL;
+	if (!(key = script_hash(source, length))) {
+		// No hashlib? Then just compile it.
+		PyErr_Clear();
+		compiles++;
+		return Py_CompileString(source, "<string>", Py_file_input);
+	}
+
+	if ((code = PyDict_GetItem(memory, key))) {
+		hits++;
+		Py_INCREF(code);
+		Py_DECREF(key);
+		return code;
+	}
+
+	onDisk = cache_directory(dir, sizeof dir);
+	if (onDisk)
+		snprintf(path, sizeof path, "%s/%s.pyc", dir, PyString_AsString(key));
+	if (onDisk && (code = load(path))) {
+		loads++;
+	} else {
+		compiles++;
+		if (!(code = Py_CompileString(source, "<string>", Py_file_input))) {
+			Py_DECREF(key);
+			return NULL;
+		}
+		if (onDisk)
+			save(path, code);
+	}
+
+	if (PyDict_Size(memory) >= MAX_CACHED_SCRIPTS)
+		PyDict_Clear(memory);
+	if (PyDict_SetItem(memory, key, code) == -1)
+		PyErr_Clear();
+	Py_DECREF(key);
+	return code;
+}
+
+void codecache_forget() {
+	// Called just before the interpreter is shut down.
+	Py_CLEAR(memory);
+	Py_CLEAR(sha1);
+}
+
+PyObject *codecache_stats() {
+	// {'hits': scripts found in memory, 'loads': read from the cache
+	// directory, 'compiles': compiled}, since Praat started.
+	return Py_BuildValue("{s:l,s:l,s:l}", "hits", hits, "loads", loads, "compiles", compiles);
+}
@@ -0,0 +1,5 @@
+// The cache of compiled scripts in codecache.c, used by python.c.
+
+PyObject *codecache_compile(const char *source, size_t length);
+void codecache_forget();
+PyObject *codecache_stats();
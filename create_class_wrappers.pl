@@ -1,5 +1,18 @@
 #!/usr/bin/perl
 
+# Writes C# wrappers for the functions in Praat's headers to stdout, or with
+#
+#     perl create_class_wrappers.pl --python Class1 Class2 ...
+#
+# the C++ source of the praat.direct Python module, which calls the
+# functions of the given classes directly (see WritePython below).
+
+if ($ARGV[0] eq '--python') {
+	shift @ARGV;
+	$python = 1;
+	%pythonClasses = map { $_ => 1 } @ARGV;
+}
+
 # Get a list of all header files
 
 foreach my $dir (scandir("..")) {
@@ -16,7 +29,7 @@ foreach my $file (@headerfiles) {
 	open FILE, $file;
 	while (!eof(FILE)) {
 		$line = <FILE>;
-		if ($line =~ /class_create \(([^, ]+)\s*,\s*([^ )]+)/i) {
+		if ($line =~ /(?:class_create|Thing_define|Thing_declare2cpp) \(([^, ]+)\s*,\s*([^ )]+)/i) {
 			push @classes, $1;
 			$classParent{$1} = $2;
 		}
@@ -42,7 +55,26 @@ foreach my $file (@headerfiles) {
 	'string' => 'string',  # used specially
 	'IntPtr' => 'IntPtr',  # used specially
 	);
-	
+
+%pytypemap = (
+    #  C  	 =>   format for PyArg_ParseTuple and Py_BuildValue
+	'void' => '',
+	'bool' => 'i',
+	'unsigned char' => 'B',
+	'short' => 'h',
+	'int' => 'i',
+	'long' => 'l',
+	'unsigned long' => 'k',
+	'float' => 'f',
+	'double' => 'd',
+	'string' => 's',  # used specially
+	'wchar' => 'O',  # only as wstring
+	'wstring' => 'O',  # used specially
+	);
+
+# For Python the C types are kept as they are.
+if ($python) { %typemap = map { $_ => $_ } keys(%pytypemap); }
+
 push @classes, keys(%typemap);
 foreach my $class (values(%typemap)) { $isNativeType{$class} = 1; }
 
@@ -95,6 +127,8 @@ foreach my $file (@headerfiles) {
 					if ($param_name eq 'void') { next; }
 
 					if ($param_type eq 'char' && $param_asterisks =~ s/^\*//) { $param_type = "string"; }
+					if ($param_type eq 'wchar' && $param_asterisks =~ s/^\*//) { $param_type = "wstring"; }
+					if ($param_type eq 'wchar') { $bad = 1; }
 
 					if (!$typemap{$param_type} && !$classParent{$param_type}) { $bad = 1; }
 					if ($typemap{$param_type}) { $param_type = $typemap{$param_type}; }
@@ -131,16 +165,25 @@ foreach my $file (@headerfiles) {
 			}
 			
 			if ($typemap{$return_type}) { $return_type = $typemap{$return_type}; }
+			if ($python && !$pytypemap{$return_type} && $return_type ne 'void' && !$classParent{$return_type}) { $bad = 1; }
 			
-			if ($bad) { next; }
+			if ($bad) {
+				if ($pythonClasses{$class}) { push @skipped, $export_name; }
+				next;
+			}
 			
 			push @{ $methods{$class} }, { export_name => $export_name, name => $method, instance => $hasthis,
-				return_type => $return_type, argtypes => [@argtypes], argnames => [@argnames] };
+				return_type => $return_type, argtypes => [@argtypes], argnames => [@argnames], file => $file };
 		}
 	}
 	close FILE;
 }
 
+if ($python) {
+	WritePython();
+	exit;
+}
+
 # base class
 
 print <<EOF;
@@ -320,3 +363,244 @@ EOF
 	return $funcs;
 
 }
+
+# The praat.direct module. Each function of the given classes whose
+# arguments and result Python can pass becomes a Python function of the same
+# name: objects are passed as praat.Object handles (or IDs), numbers and
+# strings as themselves, and an object that the function makes is added to
+# the object list like the result of a menu command. The functions that
+# can't be passed this way (see @badtypes) are listed at the end of the
+# file; for those, use the menu commands with go().
+#
+# A function that returns an object may just as well return one that
+# belongs to its argument (TextGrid_checkSpecifiedTierIsIntervalTier gives
+# one of the TextGrid's tiers), which must not go into the object list too.
+# So only the functions whose names say that they make a new object, or
+# that are in %pythonCreators, are generated; the others are listed at the
+# end of the file as well.
+
+%pythonCreators = map { $_ => 1 } qw(
+	LongSound_open Sound_readFromSoundFile
+	Table_readFromTableFile Table_readFromCharacterSeparatedTextFile
+	);
+
+sub isPythonCreator {
+	my ($name) = @_;
+	return $pythonCreators{$name} || $name =~ /_create|_to_|_extract|_copy$/;
+}
+
+sub WritePython {
+	my %includes;
+	my $functions = '';
+	my $table = '';
+	my %seen;
+	my @borrowed;
+
+	foreach my $class (sort(keys(%pythonClasses))) {
+		if (!$classParent{$class}) {
+			warn "$class is not a class in the Praat headers.";
+			next;
+		}
+		foreach my $method (@{ $methods{$class} }) {
+			my $name = $$method{export_name};
+			if ($seen{$name}++) {
+				warn "$name seems to be defined twice.";
+				next;
+			}
+			if ($classParent{$$method{return_type}} && !isPythonCreator($name)) {
+				push @borrowed, $name;
+				next;
+			}
+			$includes{$$method{file}} = 1;
+
+			my @types = @{ $$method{argtypes} };
+			my @names = @{ $$method{argnames} };
+			if ($$method{instance}) {
+				unshift @types, $class;
+				unshift @names, 'me';
+			}
+
+			my ($decls, $format, $parse, $convert, $nameFrom) = ('', '', '', '', 'NULL');
+			my @call;
+			for (my $i = 0; $i < scalar(@types); $i++) {
+				my $type = $types[$i];
+				if ($classParent{$type}) {
+					$decls .= "\tPyObject *object$i;\n";
+					$format .= 'O';
+					$parse .= ", & object$i";
+					$convert .= "\t$type arg$i = ($type) direct_object (object$i, class$type);\n\tif (! arg$i)\n\t\treturn NULL;\n";
+					if ($nameFrom eq 'NULL') { $nameFrom = "arg$i"; }
+					push @call, "arg$i";
+				} elsif ($type eq 'wstring') {
+					$decls .= "\tPyObject *object$i;\n";
+					$format .= 'O';
+					$parse .= ", & object$i";
+					$convert .= "\tDirectString arg$i;\n\tif (! direct_string (object$i, & arg$i))\n\t\treturn NULL;\n";
+					push @call, "arg$i.string";
+				} elsif ($type eq 'string') {
+					$decls .= "\tconst char *arg$i;\n";
+					$format .= 's';
+					$parse .= ", & arg$i";
+					push @call, "(char *) arg$i";
+				} else {
+					my $ctype = $type eq 'bool' ? 'int' : $type;
+					$decls .= "\t$ctype arg$i;\n";
+					$format .= $pytypemap{$type};
+					$parse .= ", & arg$i";
+					push @call, "arg$i";
+				}
+			}
+
+			my $call = "$name (" . join(", ", @call) . ")";
+			my $return_type = $$method{return_type};
+			my $body;
+			if ($return_type eq 'void') {
+				$body = "\t\t$call;\n\t\ttherror\n\t\treturn Py_BuildValue (\"\");";
+			} elsif ($classParent{$return_type}) {
+				$body = "\t\treturn direct_new ($call, $nameFrom);";
+			} else {
+				my $ctype = $return_type eq 'bool' ? 'int' : $return_type;
+				$body = "\t\t$ctype result = $call;\n\t\ttherror\n\t\treturn Py_BuildValue (\"$pytypemap{$return_type}\", result);";
+			}
+
+			my @signature;
+			for (my $i = 0; $i < scalar(@types); $i++) {
+				my $type = $types[$i];
+				$type = $type eq 'wstring' ? 'const wchar *' : $type eq 'string' ? 'const char *' : "$type ";
+				push @signature, "$type$names[$i]";
+			}
+			my $signature = "$return_type $name (" . join(", ", @signature) . ")";
+
+			$functions .= <<EOF;
+static PyObject *direct_$name (PyObject *self, PyObject *args) {
+$decls	if (! PyArg_ParseTuple (args, "$format:$name"$parse))
+		return NULL;
+$convert	try {
+$body
+	} catch (MelderError) {
+		return direct_error ();
+	}
+}
+
+EOF
+			$table .= "\t{ \"$name\", direct_$name, METH_VARARGS, \"$signature\" },\n";
+		}
+	}
+
+	my $includes = join("", map { "#include \"$_\"\n" } sort(keys(%includes)));
+	my $skipped = join("", map { "//     $_\n" } sort(@skipped));
+	my $borrowed = join("", map { "//     $_\n" } sort(@borrowed));
+	my $classes = join(" ", sort(keys(%pythonClasses)));
+
+	print <<EOF;
+// This file is generated by "create_class_wrappers.pl --python $classes"
+// from the Praat headers. Do not edit!
+
+#include <Python.h>
+
+#include "../sys/melder.h"
+#include "../sys/praatP.h"
+$includes
+#include "scripting.h"
+
+extern "C" PyObject *g_PrPyExc;
+extern "C" PyObject *praatpy_newObject (long id);
+
+EOF
+
+	print <<'EOF';
+struct DirectString {
+	wchar_t *string;
+	DirectString () : string (NULL) { }
+	~DirectString () { free (string); }
+};
+
+static Data direct_object (PyObject *item, ClassInfo klas) {
+	// The object that item, a praat.Object or an ID, stands for, if it is
+	// a klas. Otherwise sets a Python exception and returns NULL.
+	long id = -1;
+	if (PyInt_Check (item) || PyLong_Check (item)) {
+		id = PyInt_AsLong (item);
+	} else {
+		PyObject *attribute = PyObject_GetAttrString (item, "id");
+		if (! attribute)
+			return NULL;
+		id = PyInt_AsLong (attribute);
+		Py_DECREF (attribute);
+	}
+	if (id == -1 && PyErr_Occurred ())
+		return NULL;   // not a number, or too large for one
+	int i = scripting_findObject (id, NULL);
+	if (i == 0) {
+		PyErr_SetString (g_PrPyExc, "There is no such Praat object.");
+		return NULL;
+	}
+	Data object = theCurrentPraatObjects -> list [i]. object;
+	if (! Thing_member (object, klas)) {
+		char expected [100];
+		snprintf (expected, sizeof expected, "%s", Melder_peekWcsToUtf8 (klas -> className));
+		PyErr_Format (PyExc_TypeError, "Expected a %s, not a %s.", expected, Melder_peekWcsToUtf8 (Thing_className (object)));
+		return NULL;
+	}
+	scripting_queryCacheChanged (id, 0);   // the function may change it
+	return object;
+}
+
+static int direct_string (PyObject *item, DirectString *value) {
+	PyObject *unicode = PyUnicode_FromObject (item);
+	if (! unicode)
+		return 0;
+	Py_ssize_t length = PyUnicode_GET_SIZE (unicode);
+	value -> string = (wchar_t *) malloc ((length + 1) * sizeof (wchar_t));
+	if (! value -> string) {
+		Py_DECREF (unicode);
+		PyErr_NoMemory ();
+		return 0;
+	}
+	length = PyUnicode_AsWideChar ((PyUnicodeObject *) unicode, value -> string, length);
+	Py_DECREF (unicode);
+	if (length < 0)
+		return 0;
+	value -> string [length] = 0;
+	return 1;
+}
+
+static PyObject *direct_error () {
+	PyErr_SetString (g_PrPyExc, Melder_peekWcsToUtf8 (Melder_getError ()));
+	Melder_clearError ();
+	return NULL;
+}
+
+static PyObject *direct_new (Any result, Any nameFrom) {
+	// Add an object that a function has made to the object list, named
+	// after the function's first object argument, and select it.
+	if (result == NULL)
+		return direct_error ();
+	const wchar *name = nameFrom ? Thing_getName (nameFrom) : NULL;
+	praat_new1 ((Data) result, name ? name : L"direct");
+	praat_updateSelection ();
+	return praatpy_newObject (scripting_lastObjectId ());
+}
+
+EOF
+
+	print <<EOF;
+${functions}static PyMethodDef directMethods [] = {
+$table	{ NULL, NULL, 0, NULL }
+};
+
+extern "C" void praatpy_initDirect (PyObject *praat) {
+	PyObject *module = Py_InitModule3 ("praat.direct", directMethods,
+		"Praat's own functions, called directly on objects: $classes.");
+	if (module) {
+		Py_INCREF (module);
+		PyModule_AddObject (praat, "direct", module);
+	}
+}
+
+// Not generated, because Python can't pass their arguments or results:
+$skipped
+// Not generated, because the object they return may belong to an argument:
+$borrowed
+EOF
+}
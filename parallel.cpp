@@ -0,0 +1,556 @@
+// This file runs one of Praat's analyses on many objects at once, on a pool
+// of threads, for praat.parallelMap (python.c):
+//
+//     pitches = parallelMap("To Pitch...", sounds, 0.0, 75, 600)
+//
+// Praat is not thread-safe: the object list, the Info window and the error
+// buffer are all global. So only the analyses in the table below, which read
+// one Sound and make one new object without touching any of these (apart
+// from the error buffer when they fail, and Melder's allocation counters,
+// which may come out a little low), run on the threads. Finding the objects
+// beforehand and adding the new ones to the object list afterwards, in the
+// order in which the objects were given, are done on the main thread, so
+// the result doesn't depend on which thread finished first.
+//
+// The pool has one worker thread per processor (PRAATPY_THREADS to change
+// that), started when it is first needed. Each worker has a queue of tasks;
+// new tasks are dealt out over the queues in turn. A worker takes the oldest
+// task from its own queue and, once that is empty, steals the newest one
+// from another worker's, so that a worker that was dealt short Sounds helps
+// with the long ones. A thread that waits for a task steals work likewise.
+//
+// The pool also reads sound files ahead of a script for praat.prefetch; see
+// the end of this file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "../sys/melder.h"
+#include "../sys/praatP.h"
+#include "../fon/Sound_to_Pitch.h"
+#include "../fon/Sound_to_Intensity.h"
+#include "../fon/Sound_to_Formant.h"
+#include "../fon/Sound_to_Harmonicity.h"
+#include "../fon/Sound_and_Spectrum.h"
+#include "../fon/Sound.h"
+
+#include "util.h"
+#include "scripting.h"
+
+/* The pool. */
+
+struct Task {
+	void (*run) (Task *me);
+	int done;   // guarded by poolLock
+};
+
+#if defined (_WIN32)
+
+// No threads on Windows: tasks run as they are submitted.
+
+static void pool_submit (Task *task) {
+	task -> run (task);
+	task -> done = 1;
+}
+
+static int queue_remove (Task *task) {
+	return 0;
+}
+
+static void pool_wait (Task *task, int help) {
+}
+
+#else
+
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define MAX_WORKERS 64
+
+typedef struct {
+	pthread_mutex_t lock;
+	Task **tasks;   // a ring of capacity tasks, count of them from first on
+	long first, count, capacity;
+} TaskQueue;
+
+static TaskQueue queues [MAX_WORKERS];
+static int numberOfWorkers = 0, nextQueue = 0;
+static pid_t poolProcess = 0;
+
+// The number of tasks in all the queues, for idle workers to wait on.
+// Locked after a queue's lock, never before.
+static pthread_mutex_t poolLock;
+static pthread_cond_t workQueued, workDone;
+static long tasksQueued = 0;
+
+static Task *queue_take (TaskQueue *me, int oldest) {
+	Task *task = NULL;
+	pthread_mutex_lock (& my lock);
+	if (my count > 0) {
+		if (oldest) {
+			task = my tasks [my first];
+			my first = (my first + 1) % my capacity;
+		} else {
+			task = my tasks [(my first + my count - 1) % my capacity];
+		}
+		my count --;
+		pthread_mutex_lock (& poolLock);
+		tasksQueued --;
+		pthread_mutex_unlock (& poolLock);
+	}
+	pthread_mutex_unlock (& my lock);
+	return task;
+}
+
+static Task *find_task (int own) {
+	// The oldest task in queue own, or else the newest in another one.
+	// own is -1 for a thread that is not a worker.
+	Task *task;
+	if (own >= 0 && (task = queue_take (& queues [own], 1)))
+		return task;
+	for (int i = 1; i <= numberOfWorkers; i ++) {
+		int victim = (own + i) % numberOfWorkers;
+		if (victim != own && (task = queue_take (& queues [victim], 0)))
+			return task;
+	}
+	return NULL;
+}
+
+static void run_task (Task *task) {
+	task -> run (task);
+	pthread_mutex_lock (& poolLock);
+	task -> done = 1;
+	pthread_cond_broadcast (& workDone);
+	pthread_mutex_unlock (& poolLock);
+}
+
+static void *worker_main (void *closure) {
+	int own = (int) (intptr_t) closure;
+	for (;;) {
+		Task *task = find_task (own);
+		if (task) {
+			run_task (task);
+			continue;
+		}
+		pthread_mutex_lock (& poolLock);
+		while (tasksQueued == 0)
+			pthread_cond_wait (& workQueued, & poolLock);
+		pthread_mutex_unlock (& poolLock);
+	}
+	return NULL;
+}
+
+static void pool_start () {
+	// Start the workers, once per process: a worker process forked by
+	// praat-py --jobs (batch.cpp) has none of its parent's threads.
+	if (poolProcess == getpid ())
+		return;
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+	const char *setting = getenv ("PRAATPY_THREADS");
+	if (setting && atol (setting) > 0)
+		n = atol (setting);
+	if (n < 1) n = 1;
+	if (n > MAX_WORKERS) n = MAX_WORKERS;
+
+	pthread_mutex_init (& poolLock, NULL);
+	pthread_cond_init (& workQueued, NULL);
+	pthread_cond_init (& workDone, NULL);
+	tasksQueued = 0;
+	nextQueue = 0;
+	numberOfWorkers = n;
+	for (int i = 0; i < n; i ++) {
+		memset (& queues [i], 0, sizeof (TaskQueue));
+		pthread_mutex_init (& queues [i]. lock, NULL);
+	}
+	// If a thread can't be started, the tasks in its queue are stolen by
+	// the others, or in the end run by the thread that waits for them.
+	pthread_attr_t attributes;
+	pthread_attr_init (& attributes);
+	pthread_attr_setdetachstate (& attributes, PTHREAD_CREATE_DETACHED);
+	for (int i = 0; i < n; i ++) {
+		pthread_t thread;
+		pthread_create (& thread, & attributes, worker_main, (void *) (intptr_t) i);
+	}
+	pthread_attr_destroy (& attributes);
+	poolProcess = getpid ();
+}
+
+static void pool_submit (Task *task) {
+	pool_start ();
+	task -> done = 0;
+	TaskQueue *me = & queues [nextQueue ++ % numberOfWorkers];
+	pthread_mutex_lock (& my lock);
+	if (my count == my capacity) {
+		long capacity = my capacity ? 2 * my capacity : 16;
+		Task **tasks = (Task **) malloc (capacity * sizeof (Task *));
+		if (! tasks) {
+			// The queue can't grow, so the task runs right here.
+			pthread_mutex_unlock (& my lock);
+			run_task (task);
+			return;
+		}
+		for (long i = 0; i < my count; i ++)
+			tasks [i] = my tasks [(my first + i) % my capacity];
+		free (my tasks);
+		my tasks = tasks;
+		my first = 0;
+		my capacity = capacity;
+	}
+	my tasks [(my first + my count ++) % my capacity] = task;
+	pthread_mutex_lock (& poolLock);
+	tasksQueued ++;
+	pthread_cond_signal (& workQueued);
+	pthread_mutex_unlock (& poolLock);
+	pthread_mutex_unlock (& my lock);
+}
+
+static int queue_remove (Task *task) {
+	// Take task out of whichever queue it is in. Returns 0 if it isn't
+	// queued (any more).
+	for (int q = 0; q < numberOfWorkers; q ++) {
+		TaskQueue *me = & queues [q];
+		pthread_mutex_lock (& my lock);
+		for (long i = 0; i < my count; i ++) {
+			if (my tasks [(my first + i) % my capacity] != task)
+				continue;
+			for (long j = i; j > 0; j --)
+				my tasks [(my first + j) % my capacity] = my tasks [(my first + j - 1) % my capacity];
+			my first = (my first + 1) % my capacity;
+			my count --;
+			pthread_mutex_lock (& poolLock);
+			tasksQueued --;
+			pthread_mutex_unlock (& poolLock);
+			pthread_mutex_unlock (& my lock);
+			return 1;
+		}
+		pthread_mutex_unlock (& my lock);
+	}
+	return 0;
+}
+
+static void pool_wait (Task *task, int help) {
+	// Wait until task is done. If no thread has started it yet, the calling
+	// thread runs it; if help is set, it also runs other queued tasks while
+	// it waits.
+	if (queue_remove (task)) {
+		run_task (task);
+		return;
+	}
+	while (help) {
+		pthread_mutex_lock (& poolLock);
+		int done = task -> done;
+		pthread_mutex_unlock (& poolLock);
+		if (done)
+			return;
+		Task *other = find_task (-1);
+		if (! other)
+			break;
+		run_task (other);
+	}
+	pthread_mutex_lock (& poolLock);
+	while (! task -> done)
+		pthread_cond_wait (& workDone, & poolLock);
+	pthread_mutex_unlock (& poolLock);
+}
+
+#endif
+
+/* The analyses that may run on the threads, under the title of the command
+ * that does the same for selected objects, with the same arguments. */
+
+typedef Data (*Analysis) (Sound me, const double *arguments);
+
+static Data to_pitch (Sound me, const double *a) {
+	return Sound_to_Pitch (me, a [0], a [1], a [2]);
+}
+static Data to_intensity (Sound me, const double *a) {
+	return Sound_to_Intensity (me, a [0], a [1], a [2] != 0);
+}
+static Data to_formant_burg (Sound me, const double *a) {
+	return Sound_to_Formant_burg (me, a [0], a [1], a [2], a [3], a [4]);
+}
+static Data to_harmonicity_cc (Sound me, const double *a) {
+	return Sound_to_Harmonicity_cc (me, a [0], a [1], a [2], a [3]);
+}
+static Data to_spectrum (Sound me, const double *a) {
+	return Sound_to_Spectrum (me, a [0] != 0);
+}
+
+static struct {
+	const wchar_t *title;
+	int numberOfArguments;
+	Analysis analyze;
+} analyses [] = {
+	{ L"To Pitch...", 3, to_pitch },   // time step, pitch floor, pitch ceiling
+	{ L"To Intensity...", 3, to_intensity },   // pitch floor, time step, subtract mean
+	{ L"To Formant (burg)...", 5, to_formant_burg },   // time step, formants, ceiling, window length, pre-emphasis
+	{ L"To Harmonicity (cc)...", 4, to_harmonicity_cc },   // time step, pitch floor, silence threshold, periods per window
+	{ L"To Spectrum...", 1, to_spectrum },   // fast
+	{ NULL, 0, NULL }
+};
+
+struct AnalysisTask : Task {
+	Sound sound;
+	Analysis analyze;
+	const double *arguments;
+	Data result;
+};
+
+struct scripting_ParallelJob {
+	long numberOfObjects;
+	AnalysisTask *tasks;
+	double arguments [SCRIPTING_PARALLEL_MAX_ARGUMENTS];
+};
+
+static void run_analysis (Task *task) {
+	AnalysisTask *me = (AnalysisTask *) task;
+	try {
+		my result = my analyze (my sound, my arguments);
+	} catch (MelderError) {
+		my result = NULL;   // the message is found again in scripting_parallelEnd
+	}
+}
+
+extern "C" scripting_ParallelJob *scripting_parallelBegin (const wchar_t *title, const long *ids, long numberOfObjects,
+	const double *arguments, long numberOfArguments, const char **error)
+{
+	// Look up the analysis and the objects. Returns NULL with error set if
+	// one of them isn't there.
+	static char message [200];
+	int analysis = 0;
+	while (analyses [analysis]. title && wcscmp (analyses [analysis]. title, title) != 0)
+		analysis ++;
+	if (! analyses [analysis]. title) {
+		*error = "parallelMap runs only To Pitch..., To Intensity..., To Formant (burg)..., To Harmonicity (cc)... and To Spectrum...";
+		return NULL;
+	}
+	if (numberOfArguments != analyses [analysis]. numberOfArguments) {
+		snprintf (message, sizeof message, "%s takes %d arguments.", Melder_peekWcsToUtf8 (title), analyses [analysis]. numberOfArguments);
+		*error = message;
+		return NULL;
+	}
+
+	scripting_ParallelJob *job = (scripting_ParallelJob *) calloc (1, sizeof (scripting_ParallelJob));
+	if (job)
+		job -> tasks = (AnalysisTask *) calloc (numberOfObjects ? numberOfObjects : 1, sizeof (AnalysisTask));
+	if (! job || ! job -> tasks) {
+		free (job);
+		*error = "Out of memory.";
+		return NULL;
+	}
+	job -> numberOfObjects = numberOfObjects;
+	memcpy (job -> arguments, arguments, numberOfArguments * sizeof (double));
+	for (long i = 0; i < numberOfObjects; i ++) {
+		int position = 0;
+		AnalysisTask *task = & job -> tasks [i];
+		*error = NULL;
+		if (! scripting_getObjectName (ids [i], & position))
+			*error = "There is no such Praat object.";
+		else if (! Thing_member (theCurrentPraatObjects -> list [position]. object, classSound))
+			*error = "parallelMap can only analyse Sound objects.";
+		if (*error) {
+			free (job -> tasks);
+			free (job);
+			return NULL;
+		}
+		task -> run = run_analysis;
+		task -> sound = (Sound) theCurrentPraatObjects -> list [position]. object;
+		task -> analyze = analyses [analysis]. analyze;
+		task -> arguments = job -> arguments;
+	}
+	return job;
+}
+
+extern "C" void scripting_parallelRun (scripting_ParallelJob *job) {
+	// Run the analyses. This touches no Python objects, so python.c lets
+	// go of the interpreter lock meanwhile; but the objects must stay put,
+	// so other Python threads must not call Praat until it returns.
+	Melder_progressOff ();
+	for (long i = 0; i < job -> numberOfObjects; i ++)
+		pool_submit (& job -> tasks [i]);
+	for (long i = 0; i < job -> numberOfObjects; i ++)
+		pool_wait (& job -> tasks [i], 1);
+	Melder_progressOn ();
+}
+
+extern "C" wchar_t *scripting_parallelEnd (scripting_ParallelJob *job, long *newIds, int *haderror) {
+	// Add the new objects to the object list in the order of the objects
+	// they came from, named after them, select them and store their IDs in
+	// newIds. If any of the analyses failed, add none of them and return
+	// the error of the first that failed, in the arena (see util.h). Frees
+	// job.
+	wchar_t *ret = NULL;
+	long failed = 0;
+	*haderror = 0;
+	while (failed < job -> numberOfObjects && job -> tasks [failed]. result)
+		failed ++;
+	if (failed < job -> numberOfObjects) {
+		// Several threads may have written to the error buffer at once, so
+		// run the analysis that failed first again to get a clean message.
+		for (long i = 0; i < job -> numberOfObjects; i ++)
+			if (job -> tasks [i]. result)
+				forget (job -> tasks [i]. result);
+		Melder_clearError ();
+		Melder_progressOff ();
+		run_analysis (& job -> tasks [failed]);
+		Melder_progressOn ();
+		if (job -> tasks [failed]. result)
+			forget (job -> tasks [failed]. result);
+		*haderror = 1;
+		ret = arena_wcsdup (Melder_hasError () ? Melder_getError () : L"The analysis failed.");
+		Melder_clearError ();
+	} else if (job -> numberOfObjects > 0) {
+		long i = 0;
+		try {
+			for (; i < job -> numberOfObjects; i ++) {
+				AnalysisTask *task = & job -> tasks [i];
+				Data result = task -> result;
+				task -> result = NULL;
+				praat_new1 (result, Thing_getName (task -> sound));
+				newIds [i] = theCurrentPraatObjects -> list [theCurrentPraatObjects -> n]. id;
+			}
+			praat_updateSelection ();
+		} catch (MelderError) {
+			for (; i < job -> numberOfObjects; i ++)
+				if (job -> tasks [i]. result)
+					forget (job -> tasks [i]. result);
+			*haderror = 1;
+			ret = arena_wcsdup (Melder_getError ());
+			Melder_clearError ();
+		}
+	}
+	free (job -> tasks);
+	free (job);
+	return ret;
+}
+
+/* Reading sound files ahead, for praat.prefetch. While the script works on
+ * one file, the next few are read and decoded on the pool's threads. Only
+ * reading a sound file (Sound_readFromSoundFile) runs there: the files are
+ * found beforehand, and their Sounds added to the object list when the
+ * script gets to them, on the main thread.
+ *
+ * Unlike parallelMap, the script goes on running Praat commands meanwhile,
+ * and Melder's error buffer is shared between the threads. A worker thread
+ * never touches the buffer itself: a read that fails there only records
+ * that it failed, and scripting_prefetchNext clears the buffer and reads
+ * the file again on the main thread to get the message. Sound_readFromSoundFile
+ * still writes its message to the buffer as it throws, so a command on the
+ * main thread that fails before then could find that message in front of
+ * its own; files that aren't there at all, the common failure, are therefore
+ * not read ahead but left to fail when the script gets to them. */
+
+struct ReadTask : Task {
+	structMelderFile file;
+	int queued;
+	Data result;
+};
+
+struct scripting_Prefetch {
+	long capacity, first, count;   // a ring of capacity reads, count of them from first on
+	ReadTask *reads;
+};
+
+static void run_read (Task *task) {
+	ReadTask *me = (ReadTask *) task;
+	try {
+		my result = Sound_readFromSoundFile (& my file);
+	} catch (MelderError) {
+		my result = NULL;   // the message is found again in scripting_prefetchNext
+	}
+}
+
+extern "C" scripting_Prefetch *scripting_prefetchCreate (long capacity) {
+	// Room for capacity files that have been queued but not taken yet.
+	// NULL if there is no memory.
+	scripting_Prefetch *me = (scripting_Prefetch *) calloc (1, sizeof (scripting_Prefetch));
+	if (! me)
+		return NULL;
+	my capacity = capacity;
+	my reads = (ReadTask *) calloc (capacity, sizeof (ReadTask));
+	if (! my reads) {
+		free (me);
+		return NULL;
+	}
+	return me;
+}
+
+extern "C" wchar_t *scripting_prefetchQueue (scripting_Prefetch *me, const wchar_t *path, int *haderror) {
+	// Start reading the sound file at path, which is relative to the
+	// script's directory as with Read from file.... There must be room in
+	// the queue. Errors are returned as in scripting_executePraatCommand.
+	ReadTask *read = & my reads [(my first + my count) % my capacity];
+	*haderror = 0;
+	try {
+		Melder_relativePathToFile (path, & read -> file);
+		therror
+	} catch (MelderError) {
+		*haderror = 1;
+		wchar_t *ret = arena_wcsdup (Melder_getError ());
+		Melder_clearError ();
+		return ret;
+	}
+	read -> run = run_read;
+	read -> result = NULL;
+	read -> queued = MelderFile_exists (& read -> file);
+	if (read -> queued)
+		pool_submit (read);
+	my count ++;
+	return NULL;
+}
+
+extern "C" wchar_t *scripting_prefetchNext (scripting_Prefetch *me, long *id, int *haderror) {
+	// Add the Sound of the oldest file in the queue to the object list,
+	// named after the file, and select it, as Read from file... does, and
+	// store its ID in id. If it couldn't be read, return the error instead.
+	ReadTask *read = & my reads [my first];
+	my first = (my first + 1) % my capacity;
+	my count --;
+	if (read -> queued)
+		pool_wait (read, 0);
+	Data result = read -> result;
+	read -> result = NULL;
+	*haderror = 0;
+	try {
+		if (! result) {
+			// The read failed on a worker thread, whose message may be
+			// in the buffer still; read it again here to get this file's own.
+			Melder_clearError ();
+			result = Sound_readFromSoundFile (& read -> file);
+			therror
+			if (! result) {
+				*haderror = 1;
+				return arena_wcsdup (L"Cannot read the sound file.");
+			}
+		}
+		praat_new1 (result, MelderFile_name (& read -> file));
+		praat_updateSelection ();
+		*id = theCurrentPraatObjects -> list [theCurrentPraatObjects -> n]. id;
+	} catch (MelderError) {
+		*haderror = 1;
+		wchar_t *ret = arena_wcsdup (Melder_getError ());
+		Melder_clearError ();
+		return ret;
+	}
+	return NULL;
+}
+
+extern "C" void scripting_prefetchDestroy (scripting_Prefetch *me) {
+	// Cancel the reads that haven't started, wait for the others and throw
+	// away what they read, or the messages of those that failed.
+	for (long i = 0; i < my count; i ++) {
+		ReadTask *read = & my reads [(my first + i) % my capacity];
+		if (! read -> queued || queue_remove (read))
+			continue;
+		pool_wait (read, 0);
+		if (read -> result)
+			forget (read -> result);
+		else
+			Melder_clearError ();
+	}
+	free (my reads);
+	free (me);
+}
@@ -0,0 +1,183 @@
+// praat-py-send: runs a script or a command in a praat-py --serve server
+// (see serve.cpp), for headless use where sendpraat needs an X display.
+//
+//     praat-py-send SOCKET script [arg ...]
+//     praat-py-send SOCKET -c "command line"
+//
+// A script beginning with #lang=python is run as Python, any other as a
+// Praat script; "-" reads the script from standard input. The script runs
+// in our working directory with argv = [script, arg, ...]. The Info window
+// output is written to stdout as it arrives and errors to stderr, and the
+// exit status is 0 if the script or command succeeded, 1 if it failed and
+// 2 if the server could not be reached.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int write_all(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t n = write(fd, data, length);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		data += n;
+		length -= n;
+	}
+	return 1;
+}
+
+static int read_all(int fd, char *data, size_t length) {
+	while (length > 0) {
+		ssize_t n = read(fd, data, length);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		data += n;
+		length -= n;
+	}
+	return 1;
+}
+
+static int send_frame(int fd, int type, const char *payload, size_t length) {
+	unsigned char header [5];
+	header[0] = length >> 24;
+	header[1] = length >> 16;
+	header[2] = length >> 8;
+	header[3] = length;
+	header[4] = type;
+	return write_all(fd, (const char*)header, 5) && write_all(fd, payload, length);
+}
+
+static char *read_script(const char *path, size_t *length) {
+	// NULL, with errno set, if the file can't be read.
+	FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+	size_t capacity = 65536;
+	char *text, *more;
+	if (!f)
+		return NULL;
+	*length = 0;
+	if (!(text = (char*)malloc(capacity)))
+		goto nomemory;
+	for (;;) {
+		size_t n = fread(text + *length, 1, capacity - *length, f);
+		*length += n;
+		if (n == 0)
+			break;
+		if (*length == capacity) {
+			if (!(more = (char*)realloc(text, 2 * capacity)))
+				goto nomemory;
+			text = more;
+			capacity *= 2;
+		}
+	}
+	if (f != stdin)
+		fclose(f);
+	return text;
+nomemory:
+	free(text);
+	if (f != stdin)
+		fclose(f);
+	errno = ENOMEM;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	struct sockaddr_un address;
+	char directory [4096];
+	char *text;
+	size_t length;
+	int fd, i, type, lastCharacter = '\n';
+
+	if (argc < 3 || (strcmp(argv[2], "-c") == 0 && argc != 4)) {
+		fprintf(stderr, "usage: praat-py-send SOCKET script [arg ...]\n"
+			"       praat-py-send SOCKET -c \"command line\"\n");
+		return 2;
+	}
+	if (strcmp(argv[2], "-c") == 0) {
+		type = 'C';
+		text = argv[3];
+		length = strlen(text);
+	} else {
+		if (!(text = read_script(argv[2], &length))) {
+			fprintf(stderr, "praat-py-send: cannot read %s: %s\n", argv[2], strerror(errno));
+			return 2;
+		}
+		type = length >= 12 && memcmp(text, "#lang=python", 12) == 0 ? 'P' : 'S';
+	}
+
+	memset(&address, 0, sizeof address);
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof address.sun_path) {
+		fprintf(stderr, "praat-py-send: the socket name %s is too long\n", argv[1]);
+		return 2;
+	}
+	strcpy(address.sun_path, argv[1]);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof address) == -1) {
+		fprintf(stderr, "praat-py-send: cannot connect to %s: %s\n", argv[1], strerror(errno));
+		return 2;
+	}
+
+	if (getcwd(directory, sizeof directory) && !send_frame(fd, 'W', directory, strlen(directory)))
+		goto lost;
+	if (type != 'C')
+		for (i = 2; i < argc; i++)
+			if (!send_frame(fd, 'A', argv[i], strlen(argv[i])))
+				goto lost;
+	if (!send_frame(fd, type, text, length))
+		goto lost;
+
+	// Print the replies until the request is done. 'N' and 'B' frames (the
+	// number and the new objects) are for programs; the number is also in
+	// the output.
+	for (;;) {
+		unsigned char header [5];
+		size_t size;
+		char *payload;
+		if (!read_all(fd, (char*)header, 5))
+			goto lost;
+		size = (size_t)header[0] << 24 | (size_t)header[1] << 16 | (size_t)header[2] << 8 | header[3];
+		if (!(payload = (char*)malloc(size + 1))) {
+			fprintf(stderr, "praat-py-send: out of memory for a reply of %lu bytes\n", (unsigned long)size);
+			close(fd);
+			return 2;
+		}
+		if (!read_all(fd, payload, size)) {
+			free(payload);
+			goto lost;
+		}
+		payload[size] = 0;
+		if (header[4] == 'O') {
+			fwrite(payload, 1, size, stdout);
+			fflush(stdout);
+			if (size > 0)
+				lastCharacter = payload[size - 1];
+		} else if (header[4] == 'E') {
+			fflush(stdout);
+			fwrite(payload, 1, size, stderr);
+			if (size > 0 && payload[size - 1] != '\n')
+				fputc('\n', stderr);
+		} else if (header[4] == 'D') {
+			int status = strcmp(payload, "0") != 0;
+			if (lastCharacter != '\n')
+				putchar('\n');   // a query's result has no newline of its own
+			free(payload);
+			close(fd);
+			return status;
+		}
+		free(payload);
+	}
+
+lost:
+	fprintf(stderr, "praat-py-send: lost the connection to %s\n", argv[1]);
+	close(fd);
+	return 2;
+}
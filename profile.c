@@ -0,0 +1,282 @@
+// This file keeps track of where a Python script's time goes, per Praat
+// command title: how many times each command was run, how long the calls
+// took (split into turning the arguments into a command line, finding
+// the command, and running it), a histogram of the call times, and how
+// much Info window output getNum and getString captured. Whatever is left
+// of the script's time was spent in Python itself.
+//
+// It is off unless the environment variable PRAATPY_PROFILE or
+// PRAATPY_TRACE is set, or the script calls praat.profile(True). The
+// figures are reset when each script starts and are returned by
+// praat.stats(). If PRAATPY_TRACE names a file, every command call is also
+// written to it when the script ends, as a Chrome trace-event JSON file
+// (open it in chrome://tracing or Perfetto). A "%p" in the file name is
+// replaced by the process ID, which keeps --jobs workers apart.
+//
+// python.c calls scripting_profileBegin and scripting_profileEnd around
+// each command, scripting.cpp names the command and marks the end of the
+// arguments phase, and cmdindex.cpp marks the command lookup.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#if defined (_WIN32)
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+#include "scripting.h"
+
+#define MAX_TRACE_EVENTS 1000000
+
+int scripting_profiling = 0;
+
+static scripting_ProfileEntry *entries = NULL;
+static long numberOfEntries = 0, entriesCapacity = 0;
+static long *slots = NULL;   // indexes into entries by title hash, plus one; 0 is empty
+static long numberOfSlots = 0;
+
+static struct {
+	const wchar_t *title;   // points into entries, whose titles don't move
+	double start, duration;
+} *events = NULL;
+static long numberOfEvents = 0, eventsCapacity = 0, droppedEvents = 0;
+
+static int tracing = 0, commandDepth = 0, scriptDepth = 0;
+static double scriptStart = 0;
+
+static struct {
+	wchar_t title [200];
+	double start, phaseStart;
+	int phase;
+	double phases [SCRIPTING_PROFILE_PHASES];
+	long outputBytes;
+} current;
+
+static unsigned long hash_title(const wchar_t *title) {
+	unsigned long hash = 2166136261UL;
+	for (; *title; title++) {
+		hash ^= (unsigned long)*title;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+static scripting_ProfileEntry *find_entry(const wchar_t *title) {
+	// The entry for the title, added if it isn't there yet; NULL if there
+	// is no memory for it.
+	unsigned long slot;
+	long i;
+	if (2 * (numberOfEntries + 1) > numberOfSlots) {
+		long capacity = numberOfSlots ? 2 * numberOfSlots : 256;
+		long *newSlots = (long*)calloc(capacity, sizeof(long));
+		if (!newSlots)
+			return NULL;
+		free(slots);
+		slots = newSlots;
+		numberOfSlots = capacity;
+		for (i = 0; i < numberOfEntries; i++) {
+			slot = hash_title(entries[i].title) & (numberOfSlots - 1);
+			while (slots[slot])
+				slot = (slot + 1) & (numberOfSlots - 1);
+			slots[slot] = i + 1;
+		}
+	}
+	slot = hash_title(title) & (numberOfSlots - 1);
+	while (slots[slot]) {
+		if (wcscmp(entries[slots[slot] - 1].title, title) == 0)
+			return &entries[slots[slot] - 1];
+		slot = (slot + 1) & (numberOfSlots - 1);
+	}
+	if (numberOfEntries == entriesCapacity) {
+		long capacity = entriesCapacity ? 2 * entriesCapacity : 64;
+		scripting_ProfileEntry *newEntries = (scripting_ProfileEntry*)realloc(entries, capacity * sizeof(scripting_ProfileEntry));
+		if (!newEntries)
+			return NULL;
+		entries = newEntries;
+		entriesCapacity = capacity;
+	}
+	memset(&entries[numberOfEntries], 0, sizeof(scripting_ProfileEntry));
+	if (!(entries[numberOfEntries].title = wcsdup(title)))
+		return NULL;
+	slots[slot] = ++numberOfEntries;
+	return &entries[numberOfEntries - 1];
+}
+
+static void reset() {
+	long i;
+	for (i = 0; i < numberOfEntries; i++)
+		free(entries[i].title);
+	numberOfEntries = 0;
+	if (slots)
+		memset(slots, 0, numberOfSlots * sizeof(long));
+	numberOfEvents = droppedEvents = 0;
+}
+
+void scripting_profileEnable(int on) {
+	scripting_profiling = on;
+}
+
+void scripting_profileScriptBegin() {
+	// Called when a Python script starts. Nested scripts (run by a
+	// command of an outer script) are counted as part of the outer one.
+	const char *profile = getenv("PRAATPY_PROFILE"), *trace = getenv("PRAATPY_TRACE");
+	if (scriptDepth++ > 0)
+		return;
+	reset();
+	tracing = trace && *trace;
+	scripting_profiling = (profile && *profile && strcmp(profile, "0") != 0) || tracing;
+	scriptStart = scripting_clock();
+}
+
+static void write_json_string(FILE *f, const wchar_t *s) {
+	putc('"', f);
+	for (; *s; s++) {
+		unsigned long c = (unsigned long)*s;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", (int)c);
+		else if (c >= 0x20 && c < 0x7f)
+			putc((int)c, f);
+		else if (c < 0x10000)
+			fprintf(f, "\\u%04lx", c);
+		else
+			fprintf(f, "\\u%04lx\\u%04lx", 0xd800 + ((c - 0x10000) >> 10), 0xdc00 + ((c - 0x10000) & 0x3ff));
+	}
+	putc('"', f);
+}
+
+static void write_trace(const char *pattern) {
+	char path [1000];
+	const char *p = strstr(pattern, "%p");
+	long i;
+	int pid = (int)getpid();
+	FILE *f;
+
+	if (p)
+		snprintf(path, sizeof path, "%.*s%d%s", (int)(p - pattern), pattern, pid, p + 2);
+	else
+		snprintf(path, sizeof path, "%s", pattern);
+	if (!(f = fopen(path, "w"))) {
+		fprintf(stderr, "praat-py: cannot write the trace to %s\n", path);
+		return;
+	}
+	fprintf(f, "{\"traceEvents\": [\n");
+	fprintf(f, "{\"name\": \"script\", \"cat\": \"script\", \"ph\": \"X\", \"ts\": 0, \"dur\": %.3f, \"pid\": %d, \"tid\": 1}",
+		(scripting_clock() - scriptStart) * 1e6, pid);
+	for (i = 0; i < numberOfEvents; i++) {
+		fprintf(f, ",\n{\"name\": ");
+		write_json_string(f, events[i].title);
+		fprintf(f, ", \"cat\": \"command\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": 1}",
+			(events[i].start - scriptStart) * 1e6, events[i].duration * 1e6, pid);
+	}
+	fprintf(f, "\n], \"otherData\": {\"droppedEvents\": %ld}}\n", droppedEvents);
+	fclose(f);
+}
+
+void scripting_profileScriptEnd() {
+	if (--scriptDepth > 0)
+		return;
+	if (tracing)
+		write_trace(getenv("PRAATPY_TRACE"));
+}
+
+void scripting_profileBegin() {
+	// A command is about to be put together from Python values.
+	if (!scripting_profiling || commandDepth++ > 0)
+		return;
+	current.title[0] = 0;
+	current.start = current.phaseStart = scripting_clock();
+	current.phase = SCRIPTING_PROFILE_ARGUMENTS;
+	memset(current.phases, 0, sizeof current.phases);
+	current.outputBytes = 0;
+}
+
+void scripting_profileTitle(const wchar_t *title, long length) {
+	// The title is the first length characters of title, or all of it if
+	// length is negative.
+	if (!scripting_profiling || commandDepth != 1 || !title)
+		return;
+	if (length < 0 || length > 199)
+		length = 199;
+	wcsncpy(current.title, title, length);
+	current.title[length] = 0;
+}
+
+void scripting_profilePhase(int phase) {
+	// The current phase of the command ends and the given one begins.
+	double now;
+	if (!scripting_profiling || commandDepth != 1 || phase == current.phase)
+		return;
+	now = scripting_clock();
+	current.phases[current.phase] += now - current.phaseStart;
+	current.phase = phase;
+	current.phaseStart = now;
+}
+
+void scripting_profileOutput(long bytes) {
+	if (scripting_profiling && commandDepth == 1)
+		current.outputBytes += bytes;
+}
+
+void scripting_profileEnd() {
+	scripting_ProfileEntry *entry;
+	double end, duration;
+	int bucket, i;
+
+	if (!scripting_profiling || commandDepth == 0 || --commandDepth > 0)
+		return;
+	end = scripting_clock();
+	current.phases[current.phase] += end - current.phaseStart;
+	duration = end - current.start;
+
+	// A call that there is no memory to count is left out.
+	if (!(entry = find_entry(current.title[0] ? current.title : L"(unknown)")))
+		return;
+	entry->calls++;
+	entry->total += duration;
+	if (duration > entry->max)
+		entry->max = duration;
+	for (i = 0; i < SCRIPTING_PROFILE_PHASES; i++)
+		entry->phases[i] += current.phases[i];
+	entry->outputBytes += current.outputBytes;
+	// Bucket k counts the calls that took less than 2^k microseconds.
+	for (bucket = 0; bucket < SCRIPTING_PROFILE_BUCKETS - 1 && duration * 1e6 >= (double)(1L << bucket); bucket++)
+		;
+	entry->histogram[bucket]++;
+
+	if (tracing) {
+		if (numberOfEvents == MAX_TRACE_EVENTS) {
+			droppedEvents++;
+			return;
+		}
+		if (numberOfEvents == eventsCapacity) {
+			long capacity = eventsCapacity ? 2 * eventsCapacity : 4096;
+			void *newEvents = realloc(events, capacity * sizeof(*events));
+			if (!newEvents) {
+				droppedEvents++;
+				return;
+			}
+			events = newEvents;
+			eventsCapacity = capacity;
+		}
+		events[numberOfEvents].title = entry->title;
+		events[numberOfEvents].start = current.start;
+		events[numberOfEvents].duration = duration;
+		numberOfEvents++;
+	}
+}
+
+long scripting_profileCount() {
+	return numberOfEntries;
+}
+
+const scripting_ProfileEntry *scripting_profileEntry(long i) {
+	return &entries[i];
+}
+
+double scripting_profileElapsed() {
+	// Seconds since the current script started.
+	return scripting_clock() - scriptStart;
+}
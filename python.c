@@ -3,66 +3,152 @@
 
 #include <stdio.h>
 #include <wchar.h>
+#include <fcntl.h>
+#ifdef MS_WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
+#define PY_SSIZE_T_CLEAN   // lengths from "s#" are Py_ssize_t
 #include <Python.h>
 #include <structmember.h>
 
 #include "util.h"
+#include "scripting.h"
+#include "resulttable.h"
+#include "codecache.h"
+#include "querycache.h"
+#include "transcode.h"
 
 static wchar_t **global_argv;
 
 static PyObject *extfunc_selected(PyObject *, PyObject *);
+static PyObject *extfunc_reset(PyObject *, PyObject *);
 
 // We can't use the global symbols on Windows because
 // we need to get a reference to the object through
 // a function call.
-static PyObject *g_Py_False, *g_Py_True, *g_PrPyExc;
+static PyObject *g_Py_False, *g_Py_True;
+PyObject *g_PrPyExc;
 
-/* Turn a Python tuple into a wchar_t list of the command and arguments. */
+/* Turn a Python tuple into a Praat command line. */
 
-static wchar_t ** make_command(PyObject *args) {
-	// allocate the NULL-terminated array of wide-character strings
-	wchar_t **ret = (wchar_t**)calloc(PyTuple_Size(args) + 1, sizeof(wchar_t*));
+static long escape_argument(wchar_t *arg, long length) {
+	// Praat takes the last argument on a command line as it is, but the
+	// others are separated by spaces, so they are put in quotes if they
+	// contain a space or a quote, and quotes inside them are doubled. This
+	// is done in place; there must be room for 2 * length + 2 characters.
+	// Returns the new length.
+	long quotes = 0, i, j;
+	int space = 0;
+	for (i = 0; i < length; i++) {
+		if (arg[i] == '"')
+			quotes++;
+		else if (arg[i] == ' ')
+			space = 1;
+	}
+	if (!quotes && !space)
+		return length;
+	// Move the characters to their new places from the back, so that none
+	// is overwritten before it has been moved.
+	j = length + quotes + 1;
+	arg[j] = '"';
+	for (i = length - 1; i >= 0; i--) {
+		arg[--j] = arg[i];
+		if (arg[i] == '"')
+			arg[--j] = '"';
+	}
+	arg[0] = '"';
+	return length + quotes + 2;
+}
 
-	int i;
-	for (i = 0; i < PyTuple_Size(args); i++) {
-		PyObject *elem = PyTuple_GetItem(args, i);
-
-		if (elem == g_Py_False) {
-			ret[i] = wcsdup(L"false");
-		} else if (elem == g_Py_True) {
-			ret[i] = wcsdup(L"true");
-		} else if (PyInt_Check(elem)) {
-			long x = PyInt_AsLong(elem);
-			ret[i] = (wchar_t*)calloc(30, sizeof(wchar_t));
-			swprintf(ret[i], 30, L"%ld", x);
-		} else if (PyFloat_Check(elem)) {
-			double x = PyFloat_AsDouble(elem);
-			ret[i] = (wchar_t*)calloc(30, sizeof(wchar_t));
-			swprintf(ret[i], 30, L"%g", x);
-		} else if (PyString_Check(elem)) {
-			const char *src = PyString_AsString(elem);
-			ret[i] = (wchar_t*)calloc(strlen(src)+1, sizeof(wchar_t));
-			if (mbsrtowcs (ret[i], &src, strlen(src)+1, NULL) == -1)
-				PyErr_SetString(g_PrPyExc, "Wide character conversion of string argument failed.");
-		} else if (PyUnicode_Check(elem)) {
-			ret[i] = (wchar_t*)calloc(PyUnicode_GetSize(elem)+1, sizeof(wchar_t));
-			if (PyUnicode_AsWideChar((PyUnicodeObject*)elem, ret[i], PyUnicode_GetSize(elem) + 1) == -1)
-				PyErr_SetString(g_PrPyExc, "Wide character conversion of unicode argument failed.");
-		} else {
-			PyErr_SetString(g_PrPyExc, "Only Python strings, integers, floats, True, False, and Unicode strings can be used as arguments to Praat commands.");
-		}
+static size_t argument_size(PyObject *elem) {
+	// The most characters that elem can take up on a command line: every
+	// character a quote that is doubled, plus the surrounding quotes and a
+	// space. A byte string never has more wide characters than bytes.
+	size_t length = PyString_Check(elem) ? PyString_GET_SIZE(elem)
+		: PyUnicode_Check(elem) ? PyUnicode_GET_SIZE(elem) : 30;
+	return 2 * length + 3;
+}
+
+static long format_number(wchar_t *p, double x) {
+	// Enough digits for Praat to read back the same number, but no more
+	// than needed, so that 0.1 is still written as 0.1.
+	long length = swprintf(p, 30, L"%.15g", x);
+	if (wcstod(p, NULL) != x)
+		length = swprintf(p, 30, L"%.16g", x);
+	if (wcstod(p, NULL) != x)
+		length = swprintf(p, 30, L"%.17g", x);
+	return length;
+}
+
+static long format_argument(wchar_t *p, PyObject *elem) {
+	// Write elem at p, which has room for argument_size(elem) characters,
+	// and return its length. Returns -1 with a Python exception set if
+	// elem can't be turned into text.
+	long length;
+	if (elem == g_Py_False) {
+		wcscpy(p, L"false");
+		return 5;
+	} else if (elem == g_Py_True) {
+		wcscpy(p, L"true");
+		return 4;
+	} else if (PyInt_Check(elem)) {
+		return swprintf(p, 30, L"%ld", PyInt_AsLong(elem));
+	} else if (PyFloat_Check(elem)) {
+		return format_number(p, PyFloat_AsDouble(elem));
+	} else if (PyString_Check(elem)) {
+		return transcode_fromUtf8(p, PyString_AS_STRING(elem), PyString_GET_SIZE(elem));
+	} else if (PyUnicode_Check(elem)) {
+		length = PyUnicode_AsWideChar((PyUnicodeObject*)elem, p, PyUnicode_GET_SIZE(elem));
+		if (length == -1)
+			PyErr_SetString(g_PrPyExc, "Wide character conversion of unicode argument failed.");
+		return length;
 	}
+	PyErr_SetString(g_PrPyExc, "Only Python strings, integers, floats, True, False, and Unicode strings can be used as arguments to Praat commands.");
+	return -1;
+}
 
-	if (PyErr_Occurred()) {
-		// Free allocated memory and return NULL.
-		for (i = 0; i < PyTuple_Size(args); i++)
-			free(ret[i]);
-		free(ret);
-		return NULL;
-	} else {
-		return ret;
+static wchar_t *format_arguments(PyObject *args, Py_ssize_t from, Py_ssize_t to, int hasTitle, int quoteLast, long *titleLength) {
+	// Put elements from up to to of args together into a command line in
+	// the arena (see util.h). If hasTitle is true, the first of them is the
+	// command title, which is never quoted, and its length is stored in
+	// titleLength. Unless quoteLast is set, the last one is not quoted
+	// either, as on a complete command line. Returns NULL with a Python
+	// exception set if an element can't be turned into text.
+	Py_ssize_t i;
+	size_t size = 1;
+	for (i = from; i < to; i++)
+		size += argument_size(PyTuple_GET_ITEM(args, i));
+	wchar_t *ret = (wchar_t*)arena_alloc(size * sizeof(wchar_t));
+	if (!ret)
+		return (wchar_t*)PyErr_NoMemory();
+
+	wchar_t *p = ret;
+	if (titleLength)
+		*titleLength = 0;
+	for (i = from; i < to; i++) {
+		if (i > from)
+			*p++ = ' ';
+		long length = format_argument(p, PyTuple_GET_ITEM(args, i));
+		if (length == -1)
+			return NULL;
+		if (i == from && hasTitle) {
+			if (titleLength)
+				*titleLength = length;
+		} else if (i < to - 1 || quoteLast) {
+			length = escape_argument(p, length);
+		}
+		p += length;
 	}
+	*p = 0;
+	return ret;
+}
+
+static wchar_t *make_command(PyObject *args, int hasTitle, long *titleLength) {
+	// The command line for the elements of args, as format_arguments.
+	return format_arguments(args, 0, PyTuple_Size(args), hasTitle, 0, titleLength);
 }
 		
 /* Python methods in the praat module. */
@@ -71,33 +157,93 @@ PyObject *PyWString(wchar_t *wc) {
 	// Return a PyUnicode object for this string, or if that
 	// fails (don't know why it would) return a regular Python string.
 	PyObject *ret = PyUnicode_FromWideChar(wc, wcslen(wc));
-	if (!ret)
-		ret = PyString_FromString(wc2c(wc, 1));
+	if (!ret) {
+		size_t mark = arena_mark();
+		PyErr_Clear();
+		ret = PyString_FromString(arena_wc2c(wc));
+		arena_release(mark);
+	}
 	return ret;
 }
 
-static wchar_t* go_internal(PyObject *args, int captureOutput) {
+static wchar_t* command_result(wchar_t *ret, int hadError) {
+	// Turn a Praat error returned by scripting_execute... into a
+	// Python exception.
+	if (hadError) {
+		PyErr_SetString(g_PrPyExc, arena_wc2c(ret));
+		return NULL;
+	}
+
+	return ret;
+}
+
+static wchar_t* go_internal(PyObject *args, querycache_Query *query) {
+	// Run the command. Its output (if query is given, for getNum and
+	// getString) is in the arena, so the caller takes a mark first and
+	// releases it when done with it. If the result of the query is in the
+	// query cache (querycache.c), the command isn't run; see query_result.
 	int hadError;
-	wchar_t **cmd;
+	long titleLength;
+	wchar_t *cmd;
 
-	cmd = make_command(args);
-	if (!cmd)
+	info_flush();
+	scripting_profileBegin();
+	cmd = make_command(args, 1, &titleLength);
+	if (!cmd) {
+		scripting_profileEnd();
 		return NULL;
-
-	wchar_t *ret = scripting_executePraatCommand(cmd, captureOutput, &hadError);
-	
-	if (hadError) {
-		char *cret = wc2c(ret, 1);
-		PyErr_SetString(g_PrPyExc, cret);
-		free(cret);
+	}
+	if (query && querycache_lookup(query, cmd, titleLength, cmd[titleLength] ? cmd + titleLength + 1 : L"")) {
+		scripting_profileTitle(cmd, titleLength);
+		scripting_profileEnd();
 		return NULL;
 	}
 
-	return ret;
+	wchar_t *ret = scripting_executePraatCommand(cmd, titleLength, query != NULL, &hadError);
+	scripting_profileEnd();
+	return command_result(ret, hadError);
+}
+
+static PyObject* string_result(wchar_t *ret, size_t mark) {
+	PyObject *ret2 = ret ? PyWString(ret) : NULL;
+	arena_release(mark);
+	return ret2;
+}
+
+static PyObject* num_result(wchar_t *ret, size_t mark) {
+	PyObject *ret2 = NULL;
+	double x;
+	wchar_t *end;
+
+	// Most query commands report their number directly. Otherwise fall
+	// back on the first number in the Info window output.
+	if (ret && scripting_getTypedResult(&x)) {
+		ret2 = PyFloat_FromDouble(x);
+	} else if (ret) {
+		x = wcstod(ret, &end);
+		if (end != ret)
+			ret2 = PyFloat_FromDouble(x);
+		else
+			PyErr_Format(g_PrPyExc, "No numeric value found in Info window output: %.200s", arena_wc2c(ret));
+	}
+	arena_release(mark);
+	return ret2;
+}
+
+static PyObject* query_result(querycache_Query *query, wchar_t *ret, size_t mark) {
+	// The result of getNum or getString: from the query cache, or else
+	// made from the command's output and kept in the cache if it goes there.
+	if (query->cached) {
+		arena_release(mark);
+		return query->cached;
+	}
+	return querycache_store(query, query->kind == QUERYCACHE_NUMBER ? num_result(ret, mark) : string_result(ret, mark));
 }
 
 static PyObject* extfunc_go(PyObject *self, PyObject *args) {
-	go_internal(args, 0);
+	size_t mark = arena_mark();
+	go_internal(args, NULL);
+	arena_release(mark);
 	if (PyErr_Occurred())
 		return NULL;
 
@@ -110,96 +256,329 @@ static PyObject* extfunc_go(PyObject *self, PyObject *args) {
 }
 
 static PyObject* extfunc_getString(PyObject *self, PyObject *args) {
-	wchar_t *ret = go_internal(args, 1);
-	if (!ret)
-		return NULL;
-	PyObject *ret2 = PyWString(ret);
-	free(ret);
-	return ret2;
+	querycache_Query query = { QUERYCACHE_STRING, NULL, NULL, 0 };
+	size_t mark = arena_mark();
+	return query_result(&query, go_internal(args, &query), mark);
 }
 		
 static PyObject* extfunc_getNum(PyObject *self, PyObject *args) {
-	wchar_t *ret = go_internal(args, 1);
-	if (!ret)
+	querycache_Query query = { QUERYCACHE_NUMBER, NULL, NULL, 0 };
+	size_t mark = arena_mark();
+	return query_result(&query, go_internal(args, &query), mark);
+}
+	
+/* A special Python type for Praat objects, returned by go() and selected().
+ * It holds the unique ID that Praat gives each object, so that select(),
+ * remove() and the like find the object directly instead of by name, even
+ * if several objects have the same name. For older scripts it also works
+ * like the tuple (type, name). */
+
+typedef struct {
+    PyObject_HEAD
+    long id;
+    int position;
+    PyObject *type;
+    PyObject *name;
+} praatpy_Object;
+
+static PyTypeObject praatpy_ObjectObj;
+
+static PyObject *new_object(long id, int position) {
+	const wchar_t *fullName = scripting_getObjectName(id, &position);
+	if (!fullName)
+		return Py_BuildValue("");
+
+	size_t mark = arena_mark();
+	char *name = arena_wc2c(fullName);
+	char *space = strstr(name, " ");
+	if (space == NULL) {
+		arena_release(mark);
+		return Py_BuildValue("");
+	}
+	*space = 0; // split into two strings
+
+	praatpy_Object *obj = PyObject_New(praatpy_Object, &praatpy_ObjectObj);
+	if (obj) {
+		obj->id = id;
+		obj->position = position;
+		obj->type = PyString_FromString(name);
+		obj->name = PyString_FromString(space + 1);
+	}
+	arena_release(mark);
+	if (obj && (!obj->type || !obj->name)) {
+		Py_DECREF(obj);
 		return NULL;
+	}
+	return (PyObject*)obj;
+}
+
+PyObject *praatpy_newObject(long id) {
+	// For the generated praat.direct module (direct.cpp).
+	return new_object(id, 0);
+}
+
+static int get_object_id(PyObject *item, long *id, int **position) {
+	// If item is a praat.Object or an object ID, set id (and position to
+	// where to keep the position hint, if any) and return 1. Returns 0 for
+	// anything else, and -1 with an exception set for a number too large
+	// to be an ID.
+	if (PyObject_TypeCheck(item, &praatpy_ObjectObj)) {
+		*id = ((praatpy_Object*)item)->id;
+		*position = &((praatpy_Object*)item)->position;
+		return 1;
+	}
+	if (PyInt_Check(item) || PyLong_Check(item)) {
+		*id = PyInt_AsLong(item);
+		*position = NULL;
+		return *id == -1 && PyErr_Occurred() ? -1 : 1;
+	}
+	return 0;
+}
+
+static void praatpy_Object_dealloc(PyObject *self) {
+	praatpy_Object *obj = (praatpy_Object*)self;
+	Py_XDECREF(obj->type);
+	Py_XDECREF(obj->name);
+	self->ob_type->tp_free(self);
+}
+
+static PyObject *praatpy_Object_repr(PyObject *self) {
+	praatpy_Object *obj = (praatpy_Object*)self;
+	return PyString_FromFormat("<praat.Object %ld: %s %s>", obj->id,
+		PyString_AsString(obj->type), PyString_AsString(obj->name));
+}
+
+static long praatpy_Object_hash(PyObject *self) {
+	long id = ((praatpy_Object*)self)->id;
+	return id == -1 ? -2 : id;
+}
 
-	float ret2;
-	if (swscanf(ret, L"%g", &ret2)) {
-		free(ret);
-		PyObject *ret3 = PyFloat_FromDouble(ret2);
-		return ret3;
+static PyObject *praatpy_Object_richcompare(PyObject *a, PyObject *b, int op) {
+	// Objects are the same if they have the same ID. Compared with
+	// anything else, such as a (type, name) tuple, they act as that tuple.
+	if (op != Py_EQ && op != Py_NE) {
+		Py_INCREF(Py_NotImplemented);
+		return Py_NotImplemented;
+	}
+	int equal;
+	if (PyObject_TypeCheck(a, &praatpy_ObjectObj) && PyObject_TypeCheck(b, &praatpy_ObjectObj)) {
+		equal = ((praatpy_Object*)a)->id == ((praatpy_Object*)b)->id;
 	} else {
-		char buf[256];
-		char *cret = wc2c(ret, 1);
-		sprintf(buf, "No numeric value found in Info window output: %s", cret);
-		free(cret);
-		PyErr_SetString(g_PrPyExc, buf);
+		PyObject *self = PyObject_TypeCheck(a, &praatpy_ObjectObj) ? a : b;
+		PyObject *other = self == a ? b : a;
+		PyObject *tuple = PyTuple_Pack(2, ((praatpy_Object*)self)->type, ((praatpy_Object*)self)->name);
+		if (!tuple)
+			return NULL;
+		equal = PyObject_RichCompareBool(tuple, other, Py_EQ);
+		Py_DECREF(tuple);
+		if (equal == -1)
+			return NULL;
+	}
+	PyObject *ret = (equal == (op == Py_EQ)) ? Py_True : Py_False;
+	Py_INCREF(ret);
+	return ret;
+}
+
+static Py_ssize_t praatpy_Object_length(PyObject *self) {
+	return 2;
+}
+
+static PyObject *praatpy_Object_item(PyObject *self, Py_ssize_t i) {
+	praatpy_Object *obj = (praatpy_Object*)self;
+	PyObject *ret = i == 0 ? obj->type : i == 1 ? obj->name : NULL;
+	if (!ret) {
+		PyErr_SetString(PyExc_IndexError, "Praat objects only have a type (item 0) and a name (item 1).");
 		return NULL;
 	}
+	Py_INCREF(ret);
+	return ret;
 }
-	
+
+static PySequenceMethods praatpy_Object_SequenceMethods = {
+    praatpy_Object_length,     /* sq_length */
+    0,                         /* sq_concat */
+    0,                         /* sq_repeat */
+    praatpy_Object_item,       /* sq_item */
+};
+
+static PyMemberDef praatpy_Object_Members[] = {
+    {"id", T_LONG, offsetof(praatpy_Object, id), READONLY,
+     "the unique ID of the object in Praat"},
+    {"type", T_OBJECT, offsetof(praatpy_Object, type), READONLY,
+     "the type of the object, e.g. 'Sound'"},
+    {"name", T_OBJECT, offsetof(praatpy_Object, name), READONLY,
+     "the name of the object when it was returned"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_ObjectObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Object",            /*tp_name*/
+    sizeof(praatpy_Object),    /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_Object_dealloc,    /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    praatpy_Object_repr,       /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &praatpy_Object_SequenceMethods, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    praatpy_Object_hash,       /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Object",                  /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    praatpy_Object_richcompare, /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    0,                         /* tp_methods */
+    praatpy_Object_Members,    /* tp_members */
+};
+
+static PyObject *selection_items(PyObject *args) {
+	// The objects to select can be given as separate arguments or as a
+	// single list (or set, generator, ...) of them. A single tuple is
+	// still taken to be (type, name). Returns a new reference to a
+	// sequence for the PySequence_Fast macros.
+	if (PyTuple_Size(args) == 1) {
+		PyObject *arg = PyTuple_GetItem(args, 0);
+		if (!PyString_Check(arg) && !PyUnicode_Check(arg) && !PyTuple_Check(arg)
+			&& !PyObject_TypeCheck(arg, &praatpy_ObjectObj) && PyObject_HasAttrString(arg, "__iter__"))
+			return PySequence_Fast(arg, "Expected a list of Praat objects.");
+	}
+	Py_INCREF(args);
+	return args;
+}
+
+static long *get_object_ids(PyObject *items, Py_ssize_t *n) {
+	// If every one of the items is a praat.Object or an ID, return a newly
+	// allocated array of the IDs. Otherwise return NULL, with an exception
+	// set if that is because of an error.
+	*n = PySequence_Fast_GET_SIZE(items);
+	long *ids = (long*)malloc((*n + 1) * sizeof(long));
+	Py_ssize_t i;
+	if (!ids) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for (i = 0; i < *n; i++) {
+		int *position;
+		if (get_object_id(PySequence_Fast_GET_ITEM(items, i), &ids[i], &position) != 1) {
+			free(ids);
+			return NULL;
+		}
+	}
+	return ids;
+}
+
 static PyObject *extfunc_do_select(PyObject *self, PyObject *args, int mode) {
-	wchar_t** command;
 	const char *type, *name;
 	int haderror;
 	int i;
 	
-	// This accepts a variable number of arguments.
+	// This accepts a variable number of arguments, or a list.
+	PyObject *items = selection_items(args);
+	if (!items)
+		return NULL;
 	
-	if (PyTuple_Size(args) == 0) {
+	if (PySequence_Fast_GET_SIZE(items) == 0) {
+		Py_DECREF(items);
 		PyErr_SetString(g_PrPyExc, "You must pass at least one Praat object name to the select method.");
 		return NULL;
 	}
+
+	// If all of them are handles or IDs, change the selection in one go.
+	Py_ssize_t n;
+	long *ids = get_object_ids(items, &n);
+	if (ids) {
+		Py_DECREF(items);
+		long missing = scripting_selectObjects(ids, n, mode);
+		free(ids);
+		if (missing == -1)
+			return PyErr_NoMemory();
+		if (missing) {
+			PyErr_Format(g_PrPyExc, "The Praat object with ID %ld has been removed.", missing);
+			return NULL;
+		}
+		return Py_BuildValue("");
+	}
+	if (PyErr_Occurred()) {
+		Py_DECREF(items);
+		return NULL;
+	}
 	
-	for (i = 0; i < PyTuple_Size(args); i++) {
-		PyObject *item = PyTuple_GetItem(args, i);
+	for (i = 0; i < PySequence_Fast_GET_SIZE(items); i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(items, i);
+		long id;
+		int *position;
+		int isId = get_object_id(item, &id, &position);
+		if (isId < 0) {
+			Py_DECREF(items);
+			return NULL;
+		}
 		
+		// If it is a praat.Object or an ID, select it directly.
+		if (isId) {
+			int objmode = (i == 0 && mode == 0) ? 0 : (mode == 2 ? 2 : 1);
+			int unused = 0;
+			if (!scripting_selectObject(id, position ? position : &unused, objmode)) {
+				Py_DECREF(items);
+				PyErr_Format(g_PrPyExc, "The Praat object with ID %ld has been removed.", id);
+				return NULL;
+			}
+			continue;
+
 		// If it is a string, it is an object type and name together.
-		if (PyString_Check(item)) {
+		} else if (PyString_Check(item)) {
 			type = NULL;
 			name = PyString_AsString(item);
 			
 		// If it is a tuple of length two, it has (type, name)
 		} else if (PyTuple_Check(item) && PyTuple_Size(item) == 2) {
-			if (!PyArg_ParseTuple(item, "ss", &type, &name)) 
+			if (!PyArg_ParseTuple(item, "ss", &type, &name)) {
+				Py_DECREF(items);
 				return NULL;
+			}
 
 		} else {
-			PyErr_SetString(g_PrPyExc, "Arguments to select must be strings like 'LongSound mysound' or tuples like ('LongSound', 'mysound').");
+			Py_DECREF(items);
+			PyErr_SetString(g_PrPyExc, "Arguments to select must be objects returned by go() or selected(), object IDs, strings like 'LongSound mysound' or tuples like ('LongSound', 'mysound').");
 			return NULL;
 		}
 		
-		command = (wchar_t**)calloc(4, sizeof(wchar_t*));		
-		
-
-		if (i == 0 && mode == 0)
-			command[0] = wcsdup(L"select");
-		else if (mode == 0 || mode == 1)
-			command[0] = wcsdup(L"plus");
-		else if (mode == 2)
-			command[0] = wcsdup(L"minus");
-
-		if (type == NULL) {
-			command[1] = (wchar_t*)calloc(strlen(name)+1, sizeof(wchar_t));
-			command[2] = NULL;
-			swprintf(command[1], (strlen(name)+1)*sizeof(wchar_t), L"%s", name);
-		} else {
-			command[1] = (wchar_t*)calloc(strlen(type)+1, sizeof(wchar_t));
-			command[2] = (wchar_t*)calloc(strlen(name)+1, sizeof(wchar_t));
-			command[3] = NULL;
-			swprintf(command[1], (strlen(type)+1)*sizeof(wchar_t), L"%s", type);
-			swprintf(command[2], (strlen(name)+1)*sizeof(wchar_t), L"%s", name);
+		// Run "select Type name", "plus ..." or "minus ..." with the
+		// type quoted as needed.
+		const wchar_t *verb = (i == 0 && mode == 0) ? L"select" : mode == 2 ? L"minus" : L"plus";
+		size_t mark = arena_mark();
+		size_t size = wcslen(verb) + 2 * (type ? strlen(type) : 0) + strlen(name) + 5;
+		wchar_t *command = (wchar_t*)arena_alloc(size * sizeof(wchar_t));
+		wchar_t *p = command + swprintf(command, size, L"%ls ", verb);
+		if (type != NULL) {
+			p += escape_argument(p, transcode_fromUtf8(p, type, strlen(type)));
+			*p++ = ' ';
 		}
+		transcode_fromUtf8(p, name, strlen(name));
 
-		wchar_t *ret = scripting_executePraatCommand(command, 0, &haderror);
+		wchar_t *ret = scripting_executePraatCommand(command, wcslen(verb), 0, &haderror);
 		if (haderror) {
-			char *cret = wc2c(ret, 1);
-			PyErr_SetString(g_PrPyExc, cret);
-			free(cret);
+			Py_DECREF(items);
+			PyErr_SetString(g_PrPyExc, arena_wc2c(ret));
+			arena_release(mark);
 			return NULL;
 		}
+		arena_release(mark);
 	}
 
+	Py_DECREF(items);
 	return Py_BuildValue("");
 }
 
@@ -216,15 +595,90 @@ static PyObject *extfunc_minus(PyObject *self, PyObject *args) {
 }
 
 static PyObject *extfunc_remove(PyObject *self, PyObject *args) {
-	// Select...
-	PyObject *none = extfunc_select(self, args);
-	if (none == NULL) return NULL; // error condition
-	
-	// Then remove...
-	scripting_executePraatCommand2(L"Remove");
-	
-	// And return the None value constructed for us already.
-	return none;
+	PyObject *items = selection_items(args);
+	if (!items)
+		return NULL;
+
+	// If all of them are handles or IDs, remove them in one go.
+	Py_ssize_t n;
+	long *ids = get_object_ids(items, &n);
+	if (ids) {
+		long missing = n > 0 ? scripting_removeObjects(ids, n) : 0;
+		free(ids);
+		if (missing == -1) {
+			Py_DECREF(items);
+			return PyErr_NoMemory();
+		}
+		if (missing) {
+			Py_DECREF(items);
+			PyErr_Format(g_PrPyExc, "The Praat object with ID %ld has already been removed.", missing);
+			return NULL;
+		}
+		if (n > 0) {
+			Py_DECREF(items);
+			return Py_BuildValue("");
+		}
+	} else if (PyErr_Occurred()) {
+		Py_DECREF(items);
+		return NULL;
+	}
+
+	// Otherwise, every object is found before any is removed: those given
+	// by handle or ID must all still be there, and those given by name are
+	// selected, which fails if one of them isn't. Then the former are
+	// removed in one go, and the latter with Praat's Remove command.
+	PyObject *names = PyList_New(0), *nameargs = NULL, *none;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(items), numberOfIds = 0, i;
+	ids = (long*)malloc((count + 1) * sizeof(long));
+	if (!names || !ids) {
+		if (names && !ids)
+			PyErr_NoMemory();
+		goto failed;
+	}
+
+	for (i = 0; i < count; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(items, i);
+		int *position;
+		int isId = get_object_id(item, &ids[numberOfIds], &position);
+		if (isId < 0)
+			goto failed;
+		if (isId) {
+			if (!scripting_objectExists(ids[numberOfIds])) {
+				PyErr_Format(g_PrPyExc, "The Praat object with ID %ld has already been removed.", ids[numberOfIds]);
+				goto failed;
+			}
+			numberOfIds++;
+		} else if (PyList_Append(names, item) == -1) {
+			goto failed;
+		}
+	}
+
+	if (PyList_Size(names) > 0 || PyTuple_Size(args) == 0) {
+		// Select...
+		if (!(nameargs = PyList_AsTuple(names)) || !(none = extfunc_select(self, nameargs)))
+			goto failed;
+		Py_DECREF(none);
+	}
+	if (numberOfIds > 0 && scripting_removeObjects(ids, numberOfIds) == -1) {
+		PyErr_NoMemory();
+		goto failed;
+	}
+	// Then remove, unless the objects given by name were among those given by ID.
+	if (nameargs && scripting_getSelectedIds(NULL, 0) > 0)
+		scripting_executePraatCommand2(L"Remove");
+
+	Py_DECREF(items);
+	Py_DECREF(names);
+	Py_XDECREF(nameargs);
+	free(ids);
+	return Py_BuildValue("");
+
+failed:
+	Py_DECREF(items);
+	Py_XDECREF(names);
+	Py_XDECREF(nameargs);
+	free(ids);
+	return NULL;
 }
 
 static PyObject *extfunc_selected(PyObject *self, PyObject *args) {
@@ -234,117 +688,136 @@ static PyObject *extfunc_selected(PyObject *self, PyObject *args) {
 	if (args && !PyArg_ParseTuple(args, ""))
 		return NULL;
 	
-	// Prevents errors below if nothing is selected.
-	if (!is_anything_selected())
-		return Py_BuildValue("");
-	
-	wchar_t *name = get_name_of_selected();
-	if (name == NULL)
+	// Returns None if nothing is selected.
+	int position;
+	long id = scripting_getSelectedObject(&position);
+	if (id == 0)
 		return Py_BuildValue("");
 
-	char *name2 = wc2c(name, 0);
-	
-	char *space = strstr(name2, " ");
-	if (space == NULL)
-		return Py_BuildValue("");
-	
-	*space = 0; // split into two strings
-	
-	PyObject* ret = PyTuple_New(2);
-	PyTuple_SetItem(ret, 0, PyString_FromString(name2));
-	PyTuple_SetItem(ret, 1, PyString_FromString(strdup(space+1)));
-	return ret;
+	return new_object(id, position);
 }
 
-static PyObject *extfunc_argv(PyObject *self, PyObject *args) {
-	if (!PyArg_ParseTuple(args, ""))
-		return NULL;
+/* A special Python type for scopes of temporary objects, made by
+ * praat.Scope(). The Praat objects created after the scope is entered are
+ * removed when it is closed, which happens at the end of a with block even
+ * if an exception is raised in it. Objects given to keep() are left alone
+ * (though an enclosing scope will still remove them). */
 
-	if (global_argv == NULL)
-		return Py_BuildValue("");
+typedef struct {
+    PyObject_HEAD
+    long lastId;   // objects with higher IDs belong to the scope
+    long *kept;
+    long numberKept, keptCapacity;
+    long removed;
+    int open;
+} praatpy_Scope;
 
-	PyObject* ret = PyList_New(0);
-	for (int i = 0; global_argv[i]; i++)
-		PyList_Append(ret, PyWString(global_argv[i]));
-		
-	return ret;
+static int praatpy_Scope_init(PyObject *self, PyObject *args, PyObject *kwargs) {
+	praatpy_Scope *scope = (praatpy_Scope*)self;
+	if (!PyArg_ParseTuple(args, ""))
+		return -1;
+	scope->lastId = scripting_lastObjectId();
+	scope->numberKept = 0;
+	scope->removed = 0;
+	scope->open = 1;
+	return 0;
 }
 
-static PyMethodDef EmbMethods[] = {
-    {"go", extfunc_go, METH_VARARGS,
-     "Executes a Praat command, with output going to the Info window."},
-
-    {"getString", extfunc_getString, METH_VARARGS,
-     "Executes a Praat command returning the Info window output as a string."},
-
-    {"getNum", extfunc_getNum, METH_VARARGS,
-     "Executes a Praat command returning the Info window output as a float."},
-
-    {"select", extfunc_select, METH_VARARGS,
-     "Selects the Praat object (or multiple objects). Pass either a name like 'LongSound mysound' or the type and name as a tuple like select(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
-
-    {"plus", extfunc_plus, METH_VARARGS,
-     "Adds the Praat object (or multiple objects) to the current selection. Pass either a name like 'LongSound mysound' or the type and name as a tuple like plus(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
-
-    {"minus", extfunc_minus, METH_VARARGS,
-     "Deselects the Praat object (or multiple objects). Pass either a name like 'LongSound mysound' or the type and name as a tuple like minus(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
-
-    {"remove", extfunc_remove, METH_VARARGS,
-     "Removes the Praat object (or multiple objects) from the Praat objects list. Pass either a name like 'LongSound mysound' or the type and name as a tuple like remove(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
-
-    {"selected", extfunc_selected, METH_VARARGS,
-     "Returns the type and name of the selected Praat object, e.g. (type, name) = selected()."},
-
-    {"getargv", extfunc_argv, METH_VARARGS,
-     "Returns a list of the command-line arguments, including the script name itself as the first item in the list."},
-
-    {NULL, NULL, 0, NULL}
-};
+static void praatpy_Scope_dealloc(PyObject *self) {
+	free(((praatpy_Scope*)self)->kept);
+	self->ob_type->tp_free(self);
+}
 
-/* A special Python type for overriding sys.stdout/stderr to redirect it
- * to the info window. */
+static PyObject *praatpy_Scope_enter(PyObject *self, PyObject *args) {
+	praatpy_Scope *scope = (praatpy_Scope*)self;
+	scope->lastId = scripting_lastObjectId();
+	scope->open = 1;
+	Py_INCREF(self);
+	return self;
+}
 
-static PyObject *extfunc_InfoWindowWrite(PyObject *self, PyObject *args) {
-	const char *str;
-	wchar_t buffer[1024];
+static PyObject *praatpy_Scope_close(PyObject *self, PyObject *args) {
+	// Remove the scope's objects now. Returns how many were removed.
+	praatpy_Scope *scope = (praatpy_Scope*)self;
+	long removed = 0;
+	info_flush();
+	if (scope->open) {
+		removed = scripting_removeObjectsAfter(scope->lastId, scope->kept, scope->numberKept);
+		scope->removed += removed;
+		scope->open = 0;
+	}
+	return PyInt_FromLong(removed);
+}
 
-	if (!PyArg_ParseTuple(args, "s", &str))
+static PyObject *praatpy_Scope_exit(PyObject *self, PyObject *args) {
+	PyObject *removed = praatpy_Scope_close(self, NULL);
+	if (!removed)
 		return NULL;
+	Py_DECREF(removed);
+	// Don't swallow the exception, if any.
+	Py_INCREF(g_Py_False);
+	return g_Py_False;
+}
 
-	memset(buffer, 0, sizeof(buffer));
-	if (mbsrtowcs (buffer, &str, sizeof(buffer)/sizeof(wchar_t), NULL) == -1)
-		wcscpy(buffer, L"[wide character conversion failed]");
-
-	write_to_info_window(buffer);
-
+static PyObject *praatpy_Scope_keep(PyObject *self, PyObject *args) {
+	// Keep the objects (or IDs) when the scope is closed. Returns the
+	// object if there is one, so that x = scope.keep(go(...)) works.
+	praatpy_Scope *scope = (praatpy_Scope*)self;
+	Py_ssize_t i;
+	for (i = 0; i < PyTuple_Size(args); i++) {
+		long id;
+		int *position;
+		if (get_object_id(PyTuple_GET_ITEM(args, i), &id, &position) != 1) {
+			if (!PyErr_Occurred())
+				PyErr_SetString(g_PrPyExc, "Only objects returned by go() or selected(), or object IDs, can be kept.");
+			return NULL;
+		}
+		if (scope->numberKept == scope->keptCapacity) {
+			long capacity = scope->keptCapacity ? 2 * scope->keptCapacity : 16;
+			long *kept = (long*)realloc(scope->kept, capacity * sizeof(long));
+			if (!kept)
+				return PyErr_NoMemory();
+			scope->kept = kept;
+			scope->keptCapacity = capacity;
+		}
+		scope->kept[scope->numberKept++] = id;
+	}
+	if (PyTuple_Size(args) == 1) {
+		Py_INCREF(PyTuple_GET_ITEM(args, 0));
+		return PyTuple_GET_ITEM(args, 0);
+	}
 	return Py_BuildValue("");
 }
 
-typedef struct {
-    PyObject_HEAD
-    PyObject *softspace;
-} praatpy_InfoWindowStream;
-
-static PyMethodDef praatpy_InfoWindowStream_Methods[] = {
-    {"write", extfunc_InfoWindowWrite, METH_VARARGS,
-     "Writes a string to the info window."
+static PyMethodDef praatpy_Scope_Methods[] = {
+    {"__enter__", praatpy_Scope_enter, METH_NOARGS,
+     "Starts the scope: objects created from now on belong to it."
+    },
+    {"__exit__", praatpy_Scope_exit, METH_VARARGS,
+     "Closes the scope at the end of a with block."
+    },
+    {"close", praatpy_Scope_close, METH_NOARGS,
+     "Removes the objects created since the scope started, except those kept, and returns how many were removed."
+    },
+    {"keep", praatpy_Scope_keep, METH_VARARGS,
+     "Leaves these objects alone when the scope is closed."
     },
     {NULL}  /* Sentinel */
 };
 
-static PyMemberDef praatpy_InfoWindowStream_Members[] = {
-    {"softspace", T_OBJECT, offsetof(praatpy_InfoWindowStream, softspace), 0,
-     "utility field for print statement"},
+static PyMemberDef praatpy_Scope_Members[] = {
+    {"removed", T_LONG, offsetof(praatpy_Scope, removed), READONLY,
+     "the number of objects the scope has removed"},
     {NULL}
 };
 
-static PyTypeObject praatpy_InfoWindowStreamObj = {
+static PyTypeObject praatpy_ScopeObj = {
     PyObject_HEAD_INIT(NULL)
     0,                         /*ob_size*/
-    "praat.InfoWindow",        /*tp_name*/
-    sizeof(praatpy_InfoWindowStream), /*tp_basicsize*/
+    "praat.Scope",             /*tp_name*/
+    sizeof(praatpy_Scope),     /*tp_basicsize*/
     0,                         /*tp_itemsize*/
-    0,                         /*tp_dealloc*/
+    praatpy_Scope_dealloc,     /*tp_dealloc*/
     0,                         /*tp_print*/
     0,                         /*tp_getattr*/
     0,                         /*tp_setattr*/
@@ -360,61 +833,1709 @@ static PyTypeObject praatpy_InfoWindowStreamObj = {
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "InfoWindowStream",           /* tp_doc */
+    "Scope() removes the Praat objects created inside a with block when the block ends.", /* tp_doc */
     0,		               /* tp_traverse */
     0,		               /* tp_clear */
     0,		               /* tp_richcompare */
     0,		               /* tp_weaklistoffset */
     0,		               /* tp_iter */
     0,		               /* tp_iternext */
-    praatpy_InfoWindowStream_Methods,             /* tp_methods */
-    praatpy_InfoWindowStream_Members,             /* tp_members */
+    praatpy_Scope_Methods,     /* tp_methods */
+    praatpy_Scope_Members,     /* tp_members */
     0,                         /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    0,                         /* tp_init */
+    praatpy_Scope_init,        /* tp_init */
     0,                         /* tp_alloc */
     0,                         /* tp_new */
 };
 
+static PyObject *extfunc_memory(PyObject *self, PyObject *args) {
+	// Returns {'objects': the number of objects, 'bytes': their estimated
+	// size, 'peak_objects' and 'peak_bytes': the most there have been,
+	// 'types': {type: {'objects', 'bytes'}}}.
+	scripting_MemoryEntry entries[256];
+	long peakObjects, objects = 0, n, i;
+	double peakBytes, bytes = 0;
+	PyObject *types;
 
-static void initModule()  {
-    PyObject* m;
-
-    praatpy_InfoWindowStreamObj.tp_new = PyType_GenericNew;
-    if (PyType_Ready(&praatpy_InfoWindowStreamObj) < 0)
-        return;
+	if (!PyArg_ParseTuple(args, ""))
+		return NULL;
+	if (!(types = PyDict_New()))
+		return NULL;
+	n = scripting_getMemory(entries, 256, &peakObjects, &peakBytes);
+	for (i = 0; i < n; i++) {
+		PyObject *type = PyWString((wchar_t*)entries[i].type);
+		PyObject *figures = Py_BuildValue("{s:l,s:L}", "objects", entries[i].objects, "bytes", (long long)entries[i].bytes);
+		if (!type || !figures || PyDict_SetItem(types, type, figures) == -1) {
+			Py_XDECREF(type);
+			Py_XDECREF(figures);
+			Py_DECREF(types);
+			return NULL;
+		}
+		Py_DECREF(type);
+		Py_DECREF(figures);
+		objects += entries[i].objects;
+		bytes += entries[i].bytes;
+	}
+	return Py_BuildValue("{s:l,s:L,s:l,s:L,s:N}", "objects", objects, "bytes", (long long)bytes,
+		"peak_objects", peakObjects, "peak_bytes", (long long)peakBytes, "types", types);
+}
+
+/* Profiling (see profile.c). */
+
+static PyObject *extfunc_profile(PyObject *self, PyObject *args) {
+	PyObject *on = g_Py_True;
+	if (!PyArg_ParseTuple(args, "|O", &on))
+		return NULL;
+	scripting_profileEnable(PyObject_IsTrue(on));
+	return Py_BuildValue("");
+}
+
+/* Caching query results (see querycache.c). */
+
+static PyObject *extfunc_queryCache(PyObject *self, PyObject *args) {
+	PyObject *on = g_Py_True;
+	if (!PyArg_ParseTuple(args, "|O", &on))
+		return NULL;
+	querycache_enable(PyObject_IsTrue(on));
+	return Py_BuildValue("");
+}
+
+static PyObject *extfunc_stats(PyObject *self, PyObject *args) {
+	// Returns {'elapsed': seconds since the script started, 'python': the
+	// part of that not spent in commands, 'commands': {title: {...}},
+	// 'scripts': how the scripts run so far were compiled (codecache.c),
+	// 'queries': how getNum and getString did in the cache (querycache.c)}.
+	PyObject *commands, *ret;
+	double elapsed = scripting_profileElapsed(), inCommands = 0;
+	long i;
+	int k;
+
+	if (!PyArg_ParseTuple(args, ""))
+		return NULL;
+	if (!(commands = PyDict_New()))
+		return NULL;
+	for (i = 0; i < scripting_profileCount(); i++) {
+		const scripting_ProfileEntry *entry = scripting_profileEntry(i);
+		PyObject *histogram = PyList_New(0), *figures, *title;
+		for (k = 0; histogram && k < SCRIPTING_PROFILE_BUCKETS; k++) {
+			PyObject *bucket;
+			if (entry->histogram[k] == 0)
+				continue;
+			if (k < SCRIPTING_PROFILE_BUCKETS - 1)
+				bucket = Py_BuildValue("(ll)", 1L << k, entry->histogram[k]);
+			else
+				bucket = Py_BuildValue("(Ol)", Py_None, entry->histogram[k]);
+			if (!bucket || PyList_Append(histogram, bucket) == -1) {
+				Py_XDECREF(bucket);
+				Py_CLEAR(histogram);
+				break;
+			}
+			Py_DECREF(bucket);
+		}
+		figures = histogram ? Py_BuildValue("{s:l,s:d,s:d,s:d,s:d,s:d,s:d,s:l,s:N}",
+			"calls", entry->calls,
+			"total", entry->total,
+			"mean", entry->total / entry->calls,
+			"max", entry->max,
+			"arguments", entry->phases[SCRIPTING_PROFILE_ARGUMENTS],
+			"lookup", entry->phases[SCRIPTING_PROFILE_LOOKUP],
+			"run", entry->phases[SCRIPTING_PROFILE_RUN],
+			"output_bytes", entry->outputBytes,
+			"histogram", histogram) : NULL;
+		title = PyWString(entry->title);
+		if (!figures || !title || PyDict_SetItem(commands, title, figures) == -1) {
+			Py_XDECREF(figures);
+			Py_XDECREF(title);
+			Py_DECREF(commands);
+			return NULL;
+		}
+		Py_DECREF(figures);
+		Py_DECREF(title);
+		inCommands += entry->total;
+	}
+	ret = Py_BuildValue("{s:d,s:d,s:N,s:N,s:N}", "elapsed", elapsed, "python", elapsed - inCommands, "commands", commands,
+		"scripts", codecache_stats(), "queries", querycache_stats());
+	return ret;
+}
+
+static PyObject *extfunc_allocations(PyObject *self, PyObject *args) {
+	// The number of heap allocations made so far for passing commands and
+	// their results between Python and Praat (see util.h). It stays the
+	// same over calls of go() and the like once the arena has grown.
+	if (!PyArg_ParseTuple(args, ""))
+		return NULL;
+	return PyInt_FromLong(arena_allocations());
+}
+
+static PyObject *extfunc_argv(PyObject *self, PyObject *args) {
+	if (!PyArg_ParseTuple(args, ""))
+		return NULL;
+
+	if (global_argv == NULL)
+		return Py_BuildValue("");
+
+	PyObject* ret = PyList_New(0);
+	for (int i = 0; global_argv[i]; i++)
+		PyList_Append(ret, PyWString(global_argv[i]));
+		
+	return ret;
+}
+
+/* A special Python type for prepared commands, returned by praat.prepare().
+ * The command title is looked up in Praat's menus once, and calling the
+ * object only formats the arguments. Any arguments passed to prepare()
+ * are put in front of the arguments of each call. */
+
+typedef struct {
+    PyObject_HEAD
+    scripting_PreparedCommand command;
+    PyObject *title;
+    PyObject *args;
+} praatpy_Command;
+
+static wchar_t* prepared_internal(praatpy_Command *self, PyObject *args, querycache_Query *query) {
+	// Like go_internal, the output is in the arena.
+	int hadError;
+	wchar_t *cmd;
+
+	info_flush();
+	scripting_profileBegin();
+	if (PyTuple_Size(self->args) > 0) {
+		PyObject *allargs = PySequence_Concat(self->args, args);
+		if (!allargs) {
+			scripting_profileEnd();
+			return NULL;
+		}
+		cmd = make_command(allargs, 0, NULL);
+		Py_DECREF(allargs);
+	} else {
+		cmd = make_command(args, 0, NULL);
+	}
+	if (!cmd) {
+		scripting_profileEnd();
+		return NULL;
+	}
+	if (query && querycache_lookup(query, self->command.title, wcslen(self->command.title), cmd)) {
+		scripting_profileTitle(self->command.title, -1);
+		scripting_profileEnd();
+		return NULL;
+	}
+
+	wchar_t *ret = scripting_executePreparedCommand(&self->command, cmd, query != NULL, &hadError);
+	scripting_profileEnd();
+	return command_result(ret, hadError);
+}
+
+static PyObject *praatpy_Command_call(PyObject *self, PyObject *args, PyObject *kwargs) {
+	size_t mark = arena_mark();
+	prepared_internal((praatpy_Command*)self, args, NULL);
+	arena_release(mark);
+	if (PyErr_Occurred())
+		return NULL;
+	return extfunc_selected(self, NULL);
+}
+
+static PyObject *praatpy_Command_getString(PyObject *self, PyObject *args) {
+	querycache_Query query = { QUERYCACHE_STRING, NULL, NULL, 0 };
+	size_t mark = arena_mark();
+	return query_result(&query, prepared_internal((praatpy_Command*)self, args, &query), mark);
+}
+
+static PyObject *praatpy_Command_getNum(PyObject *self, PyObject *args) {
+	querycache_Query query = { QUERYCACHE_NUMBER, NULL, NULL, 0 };
+	size_t mark = arena_mark();
+	return query_result(&query, prepared_internal((praatpy_Command*)self, args, &query), mark);
+}
+
+static void praatpy_Command_dealloc(PyObject *self) {
+	praatpy_Command *cmd = (praatpy_Command*)self;
+	free(cmd->command.title);
+	Py_XDECREF(cmd->title);
+	Py_XDECREF(cmd->args);
+	self->ob_type->tp_free(self);
+}
+
+static PyObject *praatpy_Command_repr(PyObject *self) {
+	PyObject *title = PyObject_Repr(((praatpy_Command*)self)->title);
+	if (!title)
+		return NULL;
+	PyObject *ret = PyString_FromFormat("<praat.Command %s>", PyString_AsString(title));
+	Py_DECREF(title);
+	return ret;
+}
+
+static PyMethodDef praatpy_Command_Methods[] = {
+    {"getString", praatpy_Command_getString, METH_VARARGS,
+     "Runs the command returning the Info window output as a string."
+    },
+    {"getNum", praatpy_Command_getNum, METH_VARARGS,
+     "Runs the command returning the Info window output as a float."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyMemberDef praatpy_Command_Members[] = {
+    {"title", T_OBJECT, offsetof(praatpy_Command, title), READONLY,
+     "the title of the Praat command"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_CommandObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Command",           /*tp_name*/
+    sizeof(praatpy_Command),   /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_Command_dealloc,   /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    praatpy_Command_repr,      /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    praatpy_Command_call,      /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Command",                 /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    praatpy_Command_Methods,   /* tp_methods */
+    praatpy_Command_Members,   /* tp_members */
+};
+
+static PyObject *extfunc_prepare(PyObject *self, PyObject *args) {
+	if (PyTuple_Size(args) == 0) {
+		PyErr_SetString(g_PrPyExc, "You must pass the title of a Praat command to prepare.");
+		return NULL;
+	}
+
+	// Reuse make_command for the conversion of the title.
+	PyObject *title = PyTuple_GetSlice(args, 0, 1);
+	size_t mark = arena_mark();
+	wchar_t *wtitle = make_command(title, 1, NULL);
+	Py_DECREF(title);
+	if (!wtitle) {
+		arena_release(mark);
+		return NULL;
+	}
+
+	praatpy_Command *cmd = PyObject_New(praatpy_Command, &praatpy_CommandObj);
+	if (!cmd) {
+		arena_release(mark);
+		return NULL;
+	}
+	cmd->command.title = wcsdup(wtitle);
+	cmd->command.index = 0;
+	arena_release(mark);
+	cmd->title = PyTuple_GetItem(args, 0);
+	Py_INCREF(cmd->title);
+	cmd->args = PyTuple_GetSlice(args, 1, PyTuple_Size(args));
+	if (!cmd->args) {
+		Py_DECREF(cmd);
+		return NULL;
+	}
+	return (PyObject*)cmd;
+}
+
+/* A special Python type for the numbers inside a Praat object, returned
+ * by praat.getArray(). It supports the buffer protocol, so numpy can use
+ * its numbers without copying, e.g. numpy.asarray(getArray()); with
+ * getArray(view=True) these are the object's own memory. */
+
+typedef struct {
+    PyObject_HEAD
+    scripting_Array array;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    PyObject *errors;
+} praatpy_Array;
+
+static int praatpy_Array_getbuffer(PyObject *self, Py_buffer *view, int flags) {
+	praatpy_Array *arr = (praatpy_Array*)self;
+
+	// Arrays that point into a Praat object are dangling once it is gone.
+	// This is only checked here, so a buffer taken earlier is not safe
+	// (see the README).
+	if (!arr->array.copied && !scripting_objectExists(arr->array.id)) {
+		PyErr_SetString(g_PrPyExc, "The Praat object that this array belongs to has been removed.");
+		view->obj = NULL;
+		return -1;
+	}
+	// Writing into a copy of an object's numbers would silently not change
+	// the Praat object. Arrays of getNums results belong to no object.
+	if ((flags & PyBUF_WRITABLE) && arr->array.copied && arr->array.id) {
+		PyErr_SetString(PyExc_BufferError, "This array is a copy of the Praat object's data and is read-only; use getArray(view=True) to change the object.");
+		view->obj = NULL;
+		return -1;
+	}
+
+	view->buf = arr->array.data;
+	view->obj = self;
+	Py_INCREF(self);
+	view->len = arr->shape[0] * (arr->array.ndim == 2 ? arr->shape[1] : 1) * sizeof(double);
+	view->readonly = arr->array.copied && arr->array.id;
+	view->itemsize = sizeof(double);
+	view->format = (flags & PyBUF_FORMAT) ? (char*)"d" : NULL;
+	view->ndim = arr->array.ndim;
+	view->shape = (flags & PyBUF_ND) ? arr->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? arr->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static PyBufferProcs praatpy_Array_BufferProcs = {
+    0,                         /* bf_getreadbuffer */
+    0,                         /* bf_getwritebuffer */
+    0,                         /* bf_getsegcount */
+    0,                         /* bf_getcharbuffer */
+    praatpy_Array_getbuffer,   /* bf_getbuffer */
+    0,                         /* bf_releasebuffer */
+};
+
+static void praatpy_Array_dealloc(PyObject *self) {
+	praatpy_Array *arr = (praatpy_Array*)self;
+	if (arr->array.copied)
+		free(arr->array.data);
+	Py_XDECREF(arr->errors);
+	self->ob_type->tp_free(self);
+}
+
+static PyObject *praatpy_Array_getshape(PyObject *self, void *closure) {
+	praatpy_Array *arr = (praatpy_Array*)self;
+	if (arr->array.ndim == 1)
+		return Py_BuildValue("(n)", arr->shape[0]);
+	return Py_BuildValue("(nn)", arr->shape[0], arr->shape[1]);
+}
+
+static PyGetSetDef praatpy_Array_GetSet[] = {
+    {"shape", praatpy_Array_getshape, NULL, "the number of rows and columns", NULL},
+    {NULL}
+};
+
+static PyMemberDef praatpy_Array_Members[] = {
+    {"id", T_LONG, offsetof(praatpy_Array, array.id), READONLY,
+     "the ID of the Praat object the numbers come from"},
+    {"errors", T_OBJECT, offsetof(praatpy_Array, errors), READONLY,
+     "for getNums results, the error message of each element that failed, by index"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_ArrayObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Array",             /*tp_name*/
+    sizeof(praatpy_Array),     /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_Array_dealloc,     /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &praatpy_Array_BufferProcs, /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Array",                   /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    0,                         /* tp_methods */
+    praatpy_Array_Members,     /* tp_members */
+    praatpy_Array_GetSet,      /* tp_getset */
+};
+
+static PyObject *new_array(scripting_Array *array) {
+	praatpy_Array *arr = PyObject_New(praatpy_Array, &praatpy_ArrayObj);
+	if (!arr) {
+		if (array->copied)
+			free(array->data);
+		return NULL;
+	}
+	arr->array = *array;
+	arr->shape[0] = array->rows;
+	arr->shape[1] = array->columns;
+	arr->strides[0] = array->rowstride;
+	arr->strides[1] = array->columnstride;
+	arr->errors = NULL;
+	return (PyObject*)arr;
+}
+
+wchar_t *object_name(PyObject *item) {
+	// Turn an object given as 'LongSound mysound' or ('LongSound', 'mysound')
+	// into a newly allocated wide string "LongSound mysound".
+	PyObject *parts;
+	if (PyTuple_Check(item) && PyTuple_Size(item) == 2) {
+		parts = item;
+		Py_INCREF(parts);
+	} else if (PyString_Check(item) || PyUnicode_Check(item)) {
+		parts = PyTuple_Pack(1, item);
+	} else {
+		PyErr_SetString(g_PrPyExc, "Praat objects must be given as strings like 'LongSound mysound' or tuples like ('LongSound', 'mysound').");
+		return NULL;
+	}
+
+	// With the type and name given separately, this is the same as a
+	// command line whose title is the type.
+	size_t mark = arena_mark();
+	wchar_t *ret = make_command(parts, 1, NULL);
+	Py_DECREF(parts);
+	if (ret)
+		ret = wcsdup(ret);
+	arena_release(mark);
+	return ret;
+}
+
+static PyObject *extfunc_getArray(PyObject *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"object", "view", NULL};
+	PyObject *item = NULL, *view = g_Py_False;
+	wchar_t *name = NULL;
+	long id = 0;
+	int *position;
+	scripting_Array array;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO", kwlist, &item, &view))
+		return NULL;
+	if (item == Py_None)
+		item = NULL;
+	if (item) {
+		int isId = get_object_id(item, &id, &position);
+		if (isId < 0 || (!isId && !(name = object_name(item))))
+			return NULL;
+	}
+
+	const char *error = scripting_getArray(id, name, PyObject_IsTrue(view), &array);
+	free(name);
+	if (error) {
+		PyErr_SetString(g_PrPyExc, error);
+		return NULL;
+	}
+	return new_array(&array);
+}
+
+/* praat.Frames, returned by praat.frames(), goes through a LongSound (or a
+ * Sound) a frame of a fixed number of samples at a time, each frame starting
+ * step samples after the previous one. Every frame is the same praat.Array,
+ * refilled in place: when frames overlap, the overlap is moved to the front
+ * and only the new samples are read. So iterating over an hour of audio
+ * takes no more memory than one frame, and copying a frame (e.g. with
+ * numpy.array) is up to the script. The last frame is padded with zeros. */
+
+typedef struct {
+    PyObject_HEAD
+    scripting_SoundInfo sound;
+    long size, step;
+    long index;   // the first sample of the current frame, counting from 0; -1 before the first
+    long length;   // the number of samples in the current frame that are in the sound
+    praatpy_Array *frame;
+} praatpy_Frames;
+
+static void praatpy_Frames_dealloc(PyObject *self) {
+	Py_XDECREF(((praatpy_Frames*)self)->frame);
+	self->ob_type->tp_free(self);
+}
+
+static PyObject *praatpy_Frames_iternext(PyObject *self) {
+	praatpy_Frames *it = (praatpy_Frames*)self;
+	long next = it->index == -1 ? 0 : it->index + it->step;
+	long channels = it->sound.numberOfChannels, keep = 0;
+	double *data = it->frame->array.data;
+	const char *error;
+
+	if (next >= it->sound.numberOfSamples)
+		return NULL;
+	if (it->index != -1 && it->step < it->size) {
+		keep = it->size - it->step;
+		memmove(data, data + it->step * channels, keep * channels * sizeof(double));
+	}
+	if ((error = scripting_readSoundSamples(it->sound.id, next + keep + 1, it->size - keep, data + keep * channels))) {
+		PyErr_SetString(g_PrPyExc, error);
+		return NULL;
+	}
+	it->index = next;
+	it->length = it->sound.numberOfSamples - next < it->size ? it->sound.numberOfSamples - next : it->size;
+	Py_INCREF(it->frame);
+	return (PyObject*)it->frame;
+}
+
+static PyObject *praatpy_Frames_gettime(PyObject *self, void *closure) {
+	praatpy_Frames *it = (praatpy_Frames*)self;
+	return PyFloat_FromDouble(it->sound.startTime + (it->index < 0 ? 0 : it->index) / it->sound.samplingFrequency);
+}
+
+static PyGetSetDef praatpy_Frames_GetSet[] = {
+    {"time", praatpy_Frames_gettime, NULL, "the time of the first sample of the current frame", NULL},
+    {NULL}
+};
+
+static PyMemberDef praatpy_Frames_Members[] = {
+    {"index", T_LONG, offsetof(praatpy_Frames, index), READONLY,
+     "the first sample of the current frame, counting from 0"},
+    {"length", T_LONG, offsetof(praatpy_Frames, length), READONLY,
+     "the number of samples of the current frame that are in the sound; the rest are padding"},
+    {"numberOfSamples", T_LONG, offsetof(praatpy_Frames, sound.numberOfSamples), READONLY,
+     "the number of samples in the sound"},
+    {"numberOfChannels", T_INT, offsetof(praatpy_Frames, sound.numberOfChannels), READONLY,
+     "the number of channels"},
+    {"samplingFrequency", T_DOUBLE, offsetof(praatpy_Frames, sound.samplingFrequency), READONLY,
+     "the sampling frequency in Hz"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_FramesObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Frames",            /*tp_name*/
+    sizeof(praatpy_Frames),    /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_Frames_dealloc,    /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Frames",                  /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    praatpy_Frames_iternext,   /* tp_iternext */
+    0,                         /* tp_methods */
+    praatpy_Frames_Members,    /* tp_members */
+    praatpy_Frames_GetSet,     /* tp_getset */
+};
+
+static PyObject *extfunc_frames(PyObject *self, PyObject *args) {
+	PyObject *item;
+	wchar_t *name = NULL;
+	long id = 0, size, step = 0;
+	int *position;
+	scripting_SoundInfo sound;
+	scripting_Array array;
+	praatpy_Frames *it;
+
+	if (!PyArg_ParseTuple(args, "Ol|l", &item, &size, &step))
+		return NULL;
+	if (size < 1 || step < 0) {
+		PyErr_SetString(PyExc_ValueError, "The frame size must be positive and the step may not be negative.");
+		return NULL;
+	}
+	if (item != Py_None) {
+		int isId = get_object_id(item, &id, &position);
+		if (isId < 0 || (!isId && !(name = object_name(item))))
+			return NULL;
+	}
+	const char *error = scripting_getSoundInfo(id, name, &sound);
+	free(name);
+	if (error) {
+		PyErr_SetString(g_PrPyExc, error);
+		return NULL;
+	}
+
+	if ((size_t)size > PY_SSIZE_T_MAX / (sound.numberOfChannels * sizeof(double))) {
+		PyErr_SetString(PyExc_ValueError, "The frame size is too large.");
+		return NULL;
+	}
+
+	// A frame is a copy that belongs to the sound, so it is read-only to
+	// Python, but stays valid when the sound is removed.
+	memset(&array, 0, sizeof array);
+	array.data = (double*)malloc(size * sound.numberOfChannels * sizeof(double));
+	if (!array.data)
+		return PyErr_NoMemory();
+	array.copied = 1;
+	array.id = sound.id;
+	array.rows = size;
+	array.columns = sound.numberOfChannels;
+	array.ndim = sound.numberOfChannels == 1 ? 1 : 2;
+	array.columnstride = sizeof(double);
+	array.rowstride = sound.numberOfChannels * sizeof(double);
+
+	if (!(it = PyObject_New(praatpy_Frames, &praatpy_FramesObj))) {
+		free(array.data);
+		return NULL;
+	}
+	it->sound = sound;
+	it->size = size;
+	it->step = step ? step : size;
+	it->index = -1;
+	it->length = 0;
+	if (!(it->frame = (praatpy_Array*)new_array(&array))) {
+		Py_DECREF(it);
+		return NULL;
+	}
+	return (PyObject*)it;
+}
+
+/* praat.Sound and praat.Matrix hold the from_buffer constructors, which
+ * make new Praat objects out of anything that supports the buffer protocol
+ * with contiguous float64 numbers, e.g. numpy arrays. */
+
+static int get_double_buffer(PyObject *data, Py_buffer *view) {
+	if (PyObject_GetBuffer(data, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == -1)
+		return -1;
+	if (view->itemsize != sizeof(double) || !view->format
+		|| !(strcmp(view->format, "d") == 0 || strcmp(view->format, "<d") == 0
+			|| strcmp(view->format, "=d") == 0 || strcmp(view->format, "@d") == 0)) {
+		PyErr_SetString(g_PrPyExc, "The data must be contiguous 64-bit floats (e.g. a numpy array with dtype float64).");
+		PyBuffer_Release(view);
+		return -1;
+	}
+	if (view->ndim < 1 || view->ndim > 2 || view->len == 0) {
+		PyErr_SetString(g_PrPyExc, "The data must be a non-empty one- or two-dimensional array.");
+		PyBuffer_Release(view);
+		return -1;
+	}
+	return 0;
+}
+
+PyObject *created_object(wchar_t *ret, int hadError, size_t mark) {
+	// Finish a call to scripting_createSound and the like, which was made
+	// after taking the mark.
+	if (hadError) {
+		command_result(ret, hadError);
+		arena_release(mark);
+		return NULL;
+	}
+	arena_release(mark);
+	return extfunc_selected(NULL, NULL);
+}
+
+static PyObject *extfunc_Sound_from_buffer(PyObject *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"samples", "sampling_rate", "name", "start_time", NULL};
+	PyObject *data, *pyname = NULL;
+	double rate, start = 0.0;
+	wchar_t *name;
+	Py_buffer view;
+	int hadError;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Od|Od", kwlist, &data, &rate, &pyname, &start))
+		return NULL;
+	if (rate <= 0) {
+		PyErr_SetString(g_PrPyExc, "The sampling rate must be positive.");
+		return NULL;
+	}
+	if (get_double_buffer(data, &view) == -1)
+		return NULL;
+	if (!(name = pyname ? object_name(pyname) : wcsdup(L"sound"))) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	// A one-dimensional array is a mono sound, otherwise one row per channel.
+	long channels = view.ndim == 2 ? view.shape[0] : 1;
+	long samples = view.ndim == 2 ? view.shape[1] : view.shape[0];
+	size_t mark = arena_mark();
+	wchar_t *ret = scripting_createSound((double*)view.buf, channels, samples, start, rate, name, &hadError);
+	PyBuffer_Release(&view);
+	free(name);
+	return created_object(ret, hadError, mark);
+}
+
+static PyObject *extfunc_Matrix_from_buffer(PyObject *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"cells", "name", "x1", "dx", "y1", "dy", NULL};
+	PyObject *data, *pyname = NULL;
+	double x1 = 1.0, dx = 1.0, y1 = 1.0, dy = 1.0;
+	wchar_t *name;
+	Py_buffer view;
+	int hadError;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Odddd", kwlist, &data, &pyname, &x1, &dx, &y1, &dy))
+		return NULL;
+	if (get_double_buffer(data, &view) == -1)
+		return NULL;
+	if (!(name = pyname ? object_name(pyname) : wcsdup(L"matrix"))) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	long rows = view.ndim == 2 ? view.shape[0] : 1;
+	long columns = view.ndim == 2 ? view.shape[1] : view.shape[0];
+	size_t mark = arena_mark();
+	wchar_t *ret = scripting_createMatrix((double*)view.buf, rows, columns, x1, dx, y1, dy, name, &hadError);
+	PyBuffer_Release(&view);
+	free(name);
+	return created_object(ret, hadError, mark);
+}
+
+/* praat.getNums runs a query command once for each element of one of its
+ * arguments, which is a list or a buffer of numbers (e.g. a numpy array),
+ * as getNum would in a Python loop. The loop is in C, the command is looked
+ * up only once as for prepare(), and the other arguments are put into text
+ * only once. */
+
+static int is_vector_argument(PyObject *arg) {
+	if (PyString_Check(arg) || PyUnicode_Check(arg))
+		return 0;
+	return PyObject_CheckBuffer(arg) || PyObject_HasAttrString(arg, "__iter__");
+}
+
+static PyObject *extfunc_getNums(PyObject *self, PyObject *args) {
+	Py_ssize_t n = PyTuple_Size(args), k = 0, count, i;
+	PyObject *vector, *items = NULL, *errors = NULL, *ret = NULL;
+	Py_buffer view;
+	scripting_PreparedCommand command = { NULL, 0 };
+	scripting_Array array;
+	size_t mark = arena_mark();
+	wchar_t *title, *before, *after;
+	size_t beforeLength, afterLength;
+	int quoteElement;
+
+	if (n == 0) {
+		PyErr_SetString(g_PrPyExc, "You must pass the title of a Praat command to getNums.");
+		return NULL;
+	}
+	for (i = 1; i < n; i++) {
+		if (!is_vector_argument(PyTuple_GET_ITEM(args, i)))
+			continue;
+		if (k) {
+			PyErr_SetString(g_PrPyExc, "Only one of the arguments to getNums can be a list or array.");
+			return NULL;
+		}
+		k = i;
+	}
+	if (!k) {
+		PyErr_SetString(g_PrPyExc, "One of the arguments to getNums must be a list or array of values.");
+		return NULL;
+	}
+
+	vector = PyTuple_GET_ITEM(args, k);
+	view.obj = NULL;
+	if (PyObject_CheckBuffer(vector)) {
+		if (get_double_buffer(vector, &view) == -1)
+			return NULL;
+		if (view.ndim != 1) {
+			PyErr_SetString(g_PrPyExc, "The array of values for getNums must be one-dimensional.");
+			goto done;
+		}
+		count = view.shape[0];
+	} else {
+		if (!(items = PySequence_Fast(vector, "Expected a list of values.")))
+			return NULL;
+		count = PySequence_Fast_GET_SIZE(items);
+	}
+
+	// The command line of each call is the arguments before the vector,
+	// one of its elements (quoted if it is not the last argument) and the
+	// arguments after it.
+	if (!(title = format_arguments(args, 0, 1, 1, 0, NULL))
+		|| !(before = format_arguments(args, 1, k, 0, 1, NULL))
+		|| !(after = format_arguments(args, k + 1, n, 0, 0, NULL))
+		|| !(errors = PyDict_New()))
+		goto done;
+	if (!(command.title = wcsdup(title))) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	beforeLength = wcslen(before);
+	afterLength = wcslen(after);
+	quoteElement = k < n - 1;
+
+	memset(&array, 0, sizeof(array));
+	array.data = (double*)malloc((count ? count : 1) * sizeof(double));
+	if (!array.data) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	array.ndim = 1;
+	array.rows = count;
+	array.rowstride = sizeof(double);
+	array.copied = 1;
+
+	info_flush();
+	for (i = 0; i < count; i++) {
+		size_t elementMark = arena_mark();
+		PyObject *elem = items ? PySequence_Fast_GET_ITEM(items, i) : NULL;
+		wchar_t *line = (wchar_t*)arena_alloc((beforeLength + afterLength + (elem ? argument_size(elem) : 30) + 3) * sizeof(wchar_t));
+		wchar_t *p = line, *result, *message = NULL, *end;
+		long length;
+		int hadError;
+
+		if (!line) {
+			PyErr_NoMemory();
+			free(array.data);
+			goto done;
+		}
+		wmemcpy(p, before, beforeLength);
+		p += beforeLength;
+		if (beforeLength)
+			*p++ = ' ';
+		length = elem ? format_argument(p, elem) : format_number(p, ((double*)view.buf)[i]);
+		if (length == -1) {
+			arena_release(elementMark);
+			free(array.data);
+			goto done;
+		}
+		if (quoteElement)
+			length = escape_argument(p, length);
+		p += length;
+		if (afterLength)
+			*p++ = ' ';
+		wmemcpy(p, after, afterLength + 1);
+
+		scripting_profileBegin();
+		result = scripting_executePreparedCommand(&command, line, 1, &hadError);
+		scripting_profileEnd();
+
+		array.data[i] = Py_NAN;
+		if (hadError) {
+			message = result;
+		} else if (!scripting_getTypedResult(&array.data[i])) {
+			array.data[i] = wcstod(result, &end);
+			if (end == result) {
+				array.data[i] = Py_NAN;
+				message = L"No numeric value found in Info window output.";
+			}
+		}
+		if (message) {
+			PyObject *index = PyInt_FromSsize_t(i), *text = PyWString(message);
+			int failed = !index || !text || PyDict_SetItem(errors, index, text) == -1;
+			Py_XDECREF(index);
+			Py_XDECREF(text);
+			if (failed) {
+				arena_release(elementMark);
+				free(array.data);
+				goto done;
+			}
+		}
+		arena_release(elementMark);
+	}
+
+	if ((ret = new_array(&array))) {
+		((praatpy_Array*)ret)->errors = errors;
+		errors = NULL;
+	}
+
+done:
+	if (view.obj)
+		PyBuffer_Release(&view);
+	Py_XDECREF(items);
+	Py_XDECREF(errors);
+	free(command.title);
+	arena_release(mark);
+	return ret;
+}
+
+/* praat.parallelMap runs one of a few analysis commands on each of a list
+ * of Sounds, on a pool of threads (see parallel.cpp). The new objects come
+ * back in the order of the Sounds. */
+
+static PyObject *extfunc_parallelMap(PyObject *self, PyObject *args) {
+	Py_ssize_t n = PyTuple_Size(args), count, i;
+	PyObject *items, *ret = NULL;
+	double arguments[SCRIPTING_PARALLEL_MAX_ARGUMENTS];
+	size_t mark = arena_mark();
+	scripting_ParallelJob *job;
+	const char *error;
+	wchar_t *title, *message;
+	long *ids;
+	int hadError;
+
+	if (n < 2) {
+		PyErr_SetString(g_PrPyExc, "You must pass the title of an analysis command and a list of objects to parallelMap.");
+		return NULL;
+	}
+	if (n - 2 > SCRIPTING_PARALLEL_MAX_ARGUMENTS) {
+		PyErr_SetString(g_PrPyExc, "Too many arguments for parallelMap.");
+		return NULL;
+	}
+	for (i = 2; i < n; i++) {
+		arguments[i - 2] = PyFloat_AsDouble(PyTuple_GET_ITEM(args, i));
+		if (arguments[i - 2] == -1 && PyErr_Occurred())
+			return NULL;
+	}
+	if (!(title = format_arguments(args, 0, 1, 1, 0, NULL))
+		|| !(items = PySequence_Fast(PyTuple_GET_ITEM(args, 1), "Expected a list of Praat objects.")))
+		goto done;
+	ids = get_object_ids(items, &count);
+	Py_DECREF(items);
+	if (!ids) {
+		if (!PyErr_Occurred())
+			PyErr_SetString(g_PrPyExc, "parallelMap needs praat.Object handles or IDs, such as go() returns.");
+		goto done;
+	}
+
+	if (!(job = scripting_parallelBegin(title, ids, count, arguments, n - 2, &error))) {
+		PyErr_SetString(g_PrPyExc, error);
+		free(ids);
+		goto done;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	scripting_parallelRun(job);
+	Py_END_ALLOW_THREADS
+	message = scripting_parallelEnd(job, ids, &hadError);
+
+	if (hadError)
+		PyErr_SetString(g_PrPyExc, arena_wc2c(message));
+	else if ((ret = PyList_New(count)))
+		for (i = 0; i < count; i++) {
+			PyObject *obj = new_object(ids[i], 0);
+			if (!obj) {
+				Py_CLEAR(ret);
+				break;
+			}
+			PyList_SET_ITEM(ret, i, obj);
+		}
+	free(ids);
+
+done:
+	arena_release(mark);
+	return ret;
+}
+
+/* praat.prefetch(paths, depth) goes through a list (or any iterable) of
+ * sound files, yielding each as a new Sound like go("Read from file...",
+ * path) does, while the next depth files are read on other threads (see
+ * parallel.cpp). */
+
+#define MAX_PREFETCH_DEPTH 64   // files read ahead, each holding a whole Sound
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *paths;   // an iterator over the files not queued yet, or NULL at the end
+    scripting_Prefetch *prefetch;
+    long depth;
+    long queued;   // the number of files queued and not taken yet
+} praatpy_Prefetch;
+
+static void praatpy_Prefetch_dealloc(PyObject *self) {
+	praatpy_Prefetch *it = (praatpy_Prefetch*)self;
+	Py_XDECREF(it->paths);
+	if (it->prefetch)
+		scripting_prefetchDestroy(it->prefetch);
+	self->ob_type->tp_free(self);
+}
+
+static PyObject *praatpy_Prefetch_iternext(PyObject *self) {
+	praatpy_Prefetch *it = (praatpy_Prefetch*)self;
+	PyObject *path, *ret = NULL;
+	size_t mark = arena_mark();
+	wchar_t *message;
+	long id;
+	int hadError;
+
+	// Keep the file that is taken now and the next depth files queued.
+	while (it->paths && it->queued <= it->depth) {
+		if (!(path = PyIter_Next(it->paths))) {
+			Py_CLEAR(it->paths);
+			if (PyErr_Occurred())
+				goto done;
+			break;
+		}
+		if (!PyString_Check(path) && !PyUnicode_Check(path)) {
+			PyErr_SetString(PyExc_TypeError, "prefetch needs a list of file names.");
+			Py_DECREF(path);
+			goto done;
+		}
+		PyObject *parts = PyTuple_Pack(1, path);
+		Py_DECREF(path);
+		wchar_t *name = parts ? format_arguments(parts, 0, 1, 1, 0, NULL) : NULL;
+		Py_XDECREF(parts);
+		if (!name)
+			goto done;
+		message = scripting_prefetchQueue(it->prefetch, name, &hadError);
+		if (hadError) {
+			PyErr_SetString(g_PrPyExc, arena_wc2c(message));
+			goto done;
+		}
+		it->queued++;
+	}
+	if (it->queued == 0)
+		goto done;
+
+	info_flush();
+	it->queued--;
+	message = scripting_prefetchNext(it->prefetch, &id, &hadError);
+	if (hadError)
+		PyErr_SetString(g_PrPyExc, arena_wc2c(message));
+	else
+		ret = new_object(id, 0);
+
+done:
+	arena_release(mark);
+	return ret;
+}
+
+static PyMemberDef praatpy_Prefetch_Members[] = {
+    {"depth", T_LONG, offsetof(praatpy_Prefetch, depth), READONLY,
+     "the number of files read ahead"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_PrefetchObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Prefetch",          /*tp_name*/
+    sizeof(praatpy_Prefetch),  /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_Prefetch_dealloc,  /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Prefetch",                /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    praatpy_Prefetch_iternext, /* tp_iternext */
+    0,                         /* tp_methods */
+    praatpy_Prefetch_Members,  /* tp_members */
+};
+
+static PyObject *extfunc_prefetch(PyObject *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"paths", "depth", NULL};
+	PyObject *paths;
+	long depth = 2;
+	praatpy_Prefetch *it;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|l", kwlist, &paths, &depth))
+		return NULL;
+	if (depth < 1 || depth > MAX_PREFETCH_DEPTH) {
+		PyErr_Format(PyExc_ValueError, "The prefetch depth must be between 1 and %d.", MAX_PREFETCH_DEPTH);
+		return NULL;
+	}
+	if (!(paths = PyObject_GetIter(paths)))
+		return NULL;
+	if (!(it = PyObject_New(praatpy_Prefetch, &praatpy_PrefetchObj))) {
+		Py_DECREF(paths);
+		return NULL;
+	}
+	it->paths = paths;
+	it->depth = depth;
+	it->queued = 0;
+	if (!(it->prefetch = scripting_prefetchCreate(depth + 1))) {
+		Py_DECREF(it);
+		return PyErr_NoMemory();
+	}
+	return (PyObject*)it;
+}
+
+static PyMethodDef praatpy_Sound_Methods[] = {
+    {"from_buffer", (PyCFunction)extfunc_Sound_from_buffer, METH_VARARGS | METH_KEYWORDS | METH_STATIC,
+     "Sound.from_buffer(samples, sampling_rate, name='sound', start_time=0) adds a new Sound with a copy of the samples (one row per channel) to the object list, selects it and returns it like go() does."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyMethodDef praatpy_Matrix_Methods[] = {
+    {"from_buffer", (PyCFunction)extfunc_Matrix_from_buffer, METH_VARARGS | METH_KEYWORDS | METH_STATIC,
+     "Matrix.from_buffer(cells, name='matrix', x1=1, dx=1, y1=1, dy=1) adds a new Matrix with a copy of the cells (rows by columns) to the object list, selects it and returns it like go() does."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject praatpy_SoundObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Sound",             /*tp_name*/
+    sizeof(PyObject),          /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    0,                         /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Sound",                   /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    praatpy_Sound_Methods,     /* tp_methods */
+};
+
+static PyTypeObject praatpy_MatrixObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.Matrix",            /*tp_name*/
+    sizeof(PyObject),          /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    0,                         /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Matrix",                  /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    praatpy_Matrix_Methods,    /* tp_methods */
+};
+
+static PyMethodDef EmbMethods[] = {
+    {"go", extfunc_go, METH_VARARGS,
+     "Executes a Praat command, with output going to the Info window."},
+
+    {"getString", extfunc_getString, METH_VARARGS,
+     "Executes a Praat command returning the Info window output as a string."},
+
+    {"getNum", extfunc_getNum, METH_VARARGS,
+     "Executes a Praat command returning the Info window output as a float."},
+
+    {"prepare", extfunc_prepare, METH_VARARGS,
+     "Looks up a Praat command once and returns a praat.Command object that runs it when called, e.g. value = prepare('Get value at time...').getNum(t, 'Hertz', 'Linear'). Arguments after the title are passed to the command before the arguments of each call."},
+
+    {"getArray", (PyCFunction)extfunc_getArray, METH_VARARGS | METH_KEYWORDS,
+     "getArray(object=None, view=False) returns a copy of the numbers inside the selected Praat object, or the object given like 'Sound mysound', as a praat.Array that numpy can use, e.g. numpy.asarray(getArray()). Works for Sound, Matrix, Spectrogram, Pitch and Formant objects. With view=True, the array of a Sound, Matrix or Spectrogram is the object's own memory instead, which must not be used once the object has been removed."},
+
+    {"select", extfunc_select, METH_VARARGS,
+     "Selects the Praat object (or multiple objects). Pass objects returned by go() or selected(), object IDs, names like 'LongSound mysound' or the type and name as a tuple like select(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
+
+    {"plus", extfunc_plus, METH_VARARGS,
+     "Adds the Praat object (or multiple objects) to the current selection. Pass objects returned by go() or selected(), object IDs, names like 'LongSound mysound' or the type and name as a tuple like plus(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
+
+    {"minus", extfunc_minus, METH_VARARGS,
+     "Deselects the Praat object (or multiple objects). Pass objects returned by go() or selected(), object IDs, names like 'LongSound mysound' or the type and name as a tuple like minus(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
+
+    {"remove", extfunc_remove, METH_VARARGS,
+     "Removes the Praat object (or multiple objects) from the Praat objects list. Pass objects returned by go() or selected(), object IDs, names like 'LongSound mysound' or the type and name as a tuple like remove(('Sound', 'mysound1'), ('Sound', 'mysound2'))."},
+
+    {"selected", extfunc_selected, METH_VARARGS,
+     "Returns the selected Praat object as a praat.Object, which also works as its type and name, e.g. (type, name) = selected()."},
+
+    {"getargv", extfunc_argv, METH_VARARGS,
+     "Returns a list of the command-line arguments, including the script name itself as the first item in the list."},
+
+    {"profile", extfunc_profile, METH_VARARGS,
+     "profile(True) starts counting the calls and time of each Praat command, as the environment variable PRAATPY_PROFILE does; profile(False) stops."},
+
+    {"stats", extfunc_stats, METH_VARARGS,
+     "Returns what has been counted since the script started: {'elapsed': seconds, 'python': seconds outside Praat commands, 'commands': {title: {'calls', 'total', 'mean', 'max', 'arguments', 'lookup', 'run', 'output_bytes', 'histogram': [(microseconds, calls taking less), ...]}}, 'scripts': {'hits', 'loads', 'compiles'}, 'queries': {'hits', 'misses', 'stale', 'entries'}}."},
+
+    {"queryCache", extfunc_queryCache, METH_VARARGS,
+     "queryCache(True) keeps the results of getNum() and getString() for query commands until an object they looked at may have changed, as the environment variable PRAATPY_QUERY_CACHE does; queryCache(False) stops and empties the cache."},
+
+    {"allocations", extfunc_allocations, METH_VARARGS,
+     "Returns the number of heap allocations Praat-Py has made for passing commands and their results between Python and Praat. Once a script has warmed up, go(), getNum() and the like make none."},
+
+    {"getNums", extfunc_getNums, METH_VARARGS,
+     "getNums(command, arguments...) runs a query command once for each value in one of the arguments, which is a list or a one-dimensional array of numbers, and returns the numbers as a praat.Array. Elements whose command failed are NaN, and their errors are in the array's errors dict."},
+
+    {"frames", extfunc_frames, METH_VARARGS,
+     "frames(longsound, size, step=size) goes through a LongSound or Sound (None for the selected one) size samples at a time, each frame starting step samples after the previous. It yields the same praat.Array each time, refilled with the frame's samples (size x channels if there is more than one channel); copy it to keep it."},
+
+    {"parallelMap", extfunc_parallelMap, METH_VARARGS,
+     "parallelMap(command, sounds, arguments...) runs an analysis command (To Pitch..., To Intensity..., To Formant (burg)..., To Harmonicity (cc)... or To Spectrum...) with the given numeric arguments on each of a list of Sounds, several at a time on a pool of threads. The new objects are added to the object list and selected, and returned as a list in the order of the sounds. If any analysis fails, none are added and the first error is raised."},
+
+    {"prefetch", (PyCFunction)extfunc_prefetch, METH_VARARGS | METH_KEYWORDS,
+     "prefetch(paths, depth=2) goes through a list of sound files, reading the next depth files on other threads. It yields each file as a new Sound, added to the object list and selected as go(\"Read from file...\", path) does; a file that can't be read raises an error when the loop gets to it."},
+
+    {"memory", extfunc_memory, METH_VARARGS,
+     "Returns the number of Praat objects and an estimate of the memory they take: {'objects', 'bytes', 'peak_objects', 'peak_bytes', 'types': {type: {'objects', 'bytes'}}}."},
+
+    {"reset", extfunc_reset, METH_VARARGS,
+     "Shuts down the Python interpreter once the current script finishes, so that the next script starts with no modules loaded."},
+
+    {NULL, NULL, 0, NULL}
+};
+
+/* A special Python type for overriding sys.stdout/stderr to redirect it
+ * to the info window.
+ *
+ * print writes each item and separator separately, so writes are
+ * collected in info_buffer and passed on in large pieces: when the buffer
+ * fills up, before each Praat command (which may write to the Info window
+ * itself), when the script calls flush(), and when the script ends. A
+ * stream can also write straight to a file descriptor instead of the Info
+ * window; see info_stream_target. Output to stdout and stderr shares one
+ * buffer, which is flushed whenever the target changes, so that the two
+ * stay in order. */
+
+#define INFO_BUFFER_FLUSH_SIZE 65536
+
+static char *info_buffer = NULL;
+static size_t info_length = 0, info_capacity = 0;
+static int info_target = -1;   // -1 for the Info window, -2 for write_to_error_stream, else a file descriptor
+
+void info_flush() {
+	if (info_length == 0)
+		return;
+	info_buffer[info_length] = 0;
+	if (info_target < 0) {
+		size_t mark = arena_mark();
+		wchar_t *wstr = transcode_arenaUtf8ToWcs(info_buffer, info_length);
+		if (info_target == -1)
+			write_to_info_window(wstr);
+		else
+			write_to_error_stream(wstr);
+		arena_release(mark);
+	} else {
+		// Praat may have printed to the same descriptor through stdio.
+		size_t done = 0;
+		fflush(stdout);
+		fflush(stderr);
+		while (done < info_length) {
+			int n = write(info_target, info_buffer + done, info_length - done);
+			if (n <= 0)
+				break;
+			done += n;
+		}
+	}
+	info_length = 0;
+}
+
+static int info_write(int target, const char *str, size_t length) {
+	// Returns 0 with a MemoryError set if the buffer can't grow.
+	if (target != info_target) {
+		info_flush();
+		info_target = target;
+	}
+	if (info_length + length + 1 > info_capacity) {
+		size_t capacity = info_capacity ? info_capacity : 4096;
+		char *buffer;
+		while (info_length + length + 1 > capacity)
+			capacity *= 2;
+		if (!(buffer = (char*)realloc(info_buffer, capacity))) {
+			PyErr_NoMemory();
+			return 0;
+		}
+		info_buffer = buffer;
+		info_capacity = capacity;
+	}
+	memcpy(info_buffer + info_length, str, length);
+	info_length += length;
+	if (info_length >= INFO_BUFFER_FLUSH_SIZE)
+		info_flush();
+	return 1;
+}
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *softspace;
+    int fd;
+} praatpy_InfoWindowStream;
+
+static int praatpy_InfoWindowStream_init(praatpy_InfoWindowStream *self, PyObject *args, PyObject *kwargs) {
+	// InfoWindow() writes to the Info window, InfoWindow(fd) to the file
+	// descriptor fd, and InfoWindow(-2) to the error stream of a server's
+	// client (serve.cpp).
+	self->fd = -1;
+	if (!PyArg_ParseTuple(args, "|i", &self->fd))
+		return -1;
+	return 0;
+}
+
+static PyObject *extfunc_InfoWindowWrite(PyObject *self, PyObject *args) {
+	const char *str;
+	Py_ssize_t length;
+
+	if (!PyArg_ParseTuple(args, "s#", &str, &length))
+		return NULL;
+	if (!info_write(((praatpy_InfoWindowStream*)self)->fd, str, length))
+		return NULL;
+
+	return Py_BuildValue("");
+}
+
+static PyObject *extfunc_InfoWindowFlush(PyObject *self, PyObject *args) {
+	info_flush();
+	return Py_BuildValue("");
+}
+
+static PyMethodDef praatpy_InfoWindowStream_Methods[] = {
+    {"write", extfunc_InfoWindowWrite, METH_VARARGS,
+     "Writes a string to the info window."
+    },
+    {"flush", extfunc_InfoWindowFlush, METH_NOARGS,
+     "Passes on anything written so far."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyMemberDef praatpy_InfoWindowStream_Members[] = {
+    {"softspace", T_OBJECT, offsetof(praatpy_InfoWindowStream, softspace), 0,
+     "utility field for print statement"},
+    {NULL}
+};
+
+static PyTypeObject praatpy_InfoWindowStreamObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.InfoWindow",        /*tp_name*/
+    sizeof(praatpy_InfoWindowStream), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    0,                         /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "InfoWindowStream",           /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    praatpy_InfoWindowStream_Methods,             /* tp_methods */
+    praatpy_InfoWindowStream_Members,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)praatpy_InfoWindowStream_init, /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
+
+
+void praatpy_initDirect(PyObject *praat);   // in direct.cpp
+
+static void initModule()  {
+    PyObject* m;
+
+    praatpy_InfoWindowStreamObj.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&praatpy_InfoWindowStreamObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_CommandObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_ArrayObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_ObjectObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_SoundObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_MatrixObj) < 0)
+        return;
+    praatpy_ResultTableObj.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&praatpy_ResultTableObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_FramesObj) < 0)
+        return;
+    if (PyType_Ready(&praatpy_PrefetchObj) < 0)
+        return;
+    praatpy_ScopeObj.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&praatpy_ScopeObj) < 0)
+        return;
 
     m = Py_InitModule3("praat", EmbMethods, "Praat interface module.");
 
     Py_INCREF(&praatpy_InfoWindowStreamObj);
     PyModule_AddObject(m, "InfoWindow", (PyObject *)&praatpy_InfoWindowStreamObj);
+
+    Py_INCREF(&praatpy_CommandObj);
+    PyModule_AddObject(m, "Command", (PyObject *)&praatpy_CommandObj);
+
+    Py_INCREF(&praatpy_ArrayObj);
+    PyModule_AddObject(m, "Array", (PyObject *)&praatpy_ArrayObj);
+
+    Py_INCREF(&praatpy_ObjectObj);
+    PyModule_AddObject(m, "Object", (PyObject *)&praatpy_ObjectObj);
+
+    Py_INCREF(&praatpy_SoundObj);
+    PyModule_AddObject(m, "Sound", (PyObject *)&praatpy_SoundObj);
+
+    Py_INCREF(&praatpy_MatrixObj);
+    PyModule_AddObject(m, "Matrix", (PyObject *)&praatpy_MatrixObj);
+
+    Py_INCREF(&praatpy_ResultTableObj);
+    PyModule_AddObject(m, "ResultTable", (PyObject *)&praatpy_ResultTableObj);
+
+    Py_INCREF(&praatpy_FramesObj);
+    PyModule_AddObject(m, "Frames", (PyObject *)&praatpy_FramesObj);
+
+    Py_INCREF(&praatpy_PrefetchObj);
+    PyModule_AddObject(m, "Prefetch", (PyObject *)&praatpy_PrefetchObj);
+
+    Py_INCREF(&praatpy_ScopeObj);
+    PyModule_AddObject(m, "Scope", (PyObject *)&praatpy_ScopeObj);
     
     g_PrPyExc = PyErr_NewException("praat.PraatPyException", NULL, NULL);
+
+    praatpy_initDirect(m);
 }
 
-void scripting_run_python(wchar_t *script, wchar_t **argv) {
-	// Execute script as a Python script.
-	global_argv = argv;
+/* The interpreter is normally kept alive between scripts so that modules
+ * that were already imported (numpy, scipy, ...) stay warm. Each script
+ * still gets a fresh __main__ namespace, fresh sys.stdout/stderr streams
+ * and its own argv. Set the environment variable PRAATPY_NO_PERSIST to
+ * get a brand new interpreter for every script, or call praat.reset()
+ * from a script to tear the interpreter down once that script is done. */
+
+static int python_initialized = 0;
+static int python_reset_requested = 0;
+static int python_depth = 0;   // scripts running, counting those run from inside others
+
+static void python_start() {
 	Py_Initialize();
 	initModule();
 	g_Py_False = PyBool_FromLong(0);
 	g_Py_True = PyBool_FromLong(1);
+	PyRun_SimpleString("import sys");
+	PyRun_SimpleString("sys.path = ['.'] + sys.path");
+	python_initialized = 1;
+}
+
+static void python_stop() {
+	if (!python_initialized)
+		return;
+	codecache_forget();
+	querycache_forget();
+	Py_Finalize();
+	python_initialized = 0;
+	python_reset_requested = 0;
+}
+
+static void python_new_main() {
+	// Replace __main__ with an empty module so that globals left over
+	// from the previous script are not visible to this one.
+	PyObject *main = PyModule_New("__main__");
+	if (!main)
+		return;
+	PyModule_AddObject(main, "__builtins__", PyImport_ImportModule("__builtin__"));
+	PyDict_SetItemString(PyImport_GetModuleDict(), "__main__", main);
+	Py_DECREF(main);
+}
+
+static PyObject *extfunc_reset(PyObject *self, PyObject *args) {
+	if (!PyArg_ParseTuple(args, ""))
+		return NULL;
+	python_reset_requested = 1;
+	return Py_BuildValue("");
+}
+
+void scripting_start_python() {
+	// Lets the batch driver start Python before it forks its workers.
+	if (!python_initialized) {
+		python_start();
+		scripting_startupMark(L"Python");
+	}
+	scripting_startupReport();
+}
+
+void scripting_reset_python() {
+	python_stop();
+}
+
+static int info_file_descriptor() {
+	// When a script is run from the command line, the environment variable
+	// PRAATPY_INFO_FILE can send what it prints straight to a file
+	// descriptor (given as a number) or to a file (given by name, and
+	// opened once per process) instead of through the Info window. Its
+	// errors then go to stderr. Returns -1 to use the Info window.
+	static int fd = -2;
+	const char *value = getenv("PRAATPY_INFO_FILE");
+	if (global_argv == NULL || value == NULL || *value == 0)
+		return -1;
+	if (fd == -2) {
+		if (strspn(value, "0123456789") == strlen(value))
+			fd = atoi(value);
+		else
+			fd = open(value, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	return fd;
+}
+
+/* A script can run another one, for instance with go("Run script...").
+ * The inner script gets its own __main__ and argv like any other, and the
+ * outer script's are put back when it is done: in Python 2, a module that
+ * is freed sets its globals to None, which would leave the outer script
+ * running with all of its names gone. */
+
+typedef struct {
+	wchar_t **argv;
+	PyObject *main, *sysArgv, *praatArgv, *stdout_, *stderr_;
+} OuterScript;
+
+static void outer_save(OuterScript *outer) {
+	PyObject *praat = PyDict_GetItemString(PyImport_GetModuleDict(), "praat");
+	outer->argv = global_argv;
+	outer->main = PyDict_GetItemString(PyImport_GetModuleDict(), "__main__");
+	outer->sysArgv = PySys_GetObject("argv");
+	outer->praatArgv = praat ? PyObject_GetAttrString(praat, "argv") : NULL;
+	outer->stdout_ = PySys_GetObject("stdout");
+	outer->stderr_ = PySys_GetObject("stderr");
+	PyErr_Clear();
+	Py_XINCREF(outer->main);
+	Py_XINCREF(outer->sysArgv);
+	Py_XINCREF(outer->stdout_);
+	Py_XINCREF(outer->stderr_);
+}
+
+static void outer_restore(OuterScript *outer) {
+	PyObject *praat = PyDict_GetItemString(PyImport_GetModuleDict(), "praat");
+	global_argv = outer->argv;
+	if (outer->main)
+		PyDict_SetItemString(PyImport_GetModuleDict(), "__main__", outer->main);
+	if (outer->sysArgv)
+		PySys_SetObject("argv", outer->sysArgv);
+	if (praat && outer->praatArgv)
+		PyObject_SetAttrString(praat, "argv", outer->praatArgv);
+	if (outer->stdout_)
+		PySys_SetObject("stdout", outer->stdout_);
+	if (outer->stderr_)
+		PySys_SetObject("stderr", outer->stderr_);
+	Py_XDECREF(outer->main);
+	Py_XDECREF(outer->sysArgv);
+	Py_XDECREF(outer->praatArgv);
+	Py_XDECREF(outer->stdout_);
+	Py_XDECREF(outer->stderr_);
+}
+
+int scripting_run_python(wchar_t *script, wchar_t **argv) {
+	// Execute script as a Python script. Returns 1 if it raised an
+	// exception (or called sys.exit with a status other than 0).
+	int failed = 0;
+	OuterScript outer = { NULL };   // filled in only for a nested run
+	if (python_depth > 0)
+		outer_save(&outer);
+	python_depth++;
+	global_argv = argv;
+	if (!python_initialized) {
+		python_start();
+		scripting_startupMark(L"Python");
+	}
+	scripting_startupReport();
+
+	python_new_main();
 	PyRun_SimpleString("import praat");
+	PyRun_SimpleString("import sys");
 	PyRun_SimpleString("praat.argv = praat.getargv()");
+	PyRun_SimpleString("sys.argv = praat.argv or ['']");
 	PyRun_SimpleString("from praat import *");
-	PyRun_SimpleString("import sys");
-	PyRun_SimpleString("sys.stdout = InfoWindow()");
-	PyRun_SimpleString("sys.stderr = InfoWindow()");
-	PyRun_SimpleString("sys.path = ['.'] + sys.path");
+	int fd = info_file_descriptor();
+	if (scripting_capturingInfo()) {
+		PyRun_SimpleString("sys.stdout = InfoWindow()");
+		PyRun_SimpleString("sys.stderr = InfoWindow(-2)");
+	} else if (fd >= 0) {
+		char line[64];
+		sprintf(line, "sys.stdout = InfoWindow(%d)", fd);
+		PyRun_SimpleString(line);
+		PyRun_SimpleString("sys.stderr = InfoWindow(2)");
+	} else {
+		PyRun_SimpleString("sys.stdout = InfoWindow()");
+		PyRun_SimpleString("sys.stderr = InfoWindow()");
+	}
 		
-	char *cscript = wc2c(script, 0);
-	PyRun_SimpleString(cscript);
+	// The script is compiled only the first time it's run (codecache.c).
+	// Like PyRun_SimpleString, errors are printed to sys.stderr.
+	scripting_profileScriptBegin();
+	querycache_scriptBegin();
+	char *cscript = transcode_wcsToUtf8(script);
+	PyObject *code = codecache_compile(cscript, strlen(cscript));
 	free(cscript);
-		
-	Py_Finalize();
-}
+	if (code) {
+		PyObject *globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+		PyObject *result = PyEval_EvalCode((PyCodeObject*)code, globals, globals);
+		Py_DECREF(code);
+		Py_XDECREF(result);
+	}
+	if (PyErr_Occurred()) {
+		failed = 1;
+		if ((scripting_capturingInfo() || scripting_batchWorker) && PyErr_ExceptionMatches(PyExc_SystemExit)) {
+			// A client's sys.exit() ends its script, not the server, and
+			// a batch job's ends the job, not the worker process.
+			PyObject *type, *value, *traceback, *status;
+			PyErr_Fetch(&type, &value, &traceback);
+			PyErr_NormalizeException(&type, &value, &traceback);
+			status = value ? PyObject_GetAttrString(value, "code") : NULL;
+			PyErr_Clear();
+			failed = status && status != Py_None && !(PyInt_Check(status) && PyInt_AS_LONG(status) == 0);
+			Py_XDECREF(status);
+			Py_XDECREF(type);
+			Py_XDECREF(value);
+			Py_XDECREF(traceback);
+		} else {
+			PyErr_Print();
+		}
+	}
+	querycache_scriptEnd();
+	scripting_profileScriptEnd();
+	info_flush();
 
+	if (--python_depth > 0) {
+		outer_restore(&outer);
+		return failed;
+	}
+	global_argv = NULL;
+	if (python_reset_requested || getenv("PRAATPY_NO_PERSIST"))
+		python_stop();
+	return failed;
+}
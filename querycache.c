@@ -0,0 +1,329 @@
+// This file keeps the results of query commands like "Get end time" that
+// getNum and getString run, so that a script asking the same question
+// about the same objects again, as scripts do in their loops, gets the
+// answer from a dictionary instead of running the command again.
+//
+// It is off unless the environment variable PRAATPY_QUERY_CACHE is set or
+// the script calls praat.queryCache(True), and it is emptied when each
+// script starts. Only the commands in pureQueries are cached: they report
+// something about the selected objects and change nothing. A result is
+// kept under the command line and the IDs of the selected objects, and is
+// used for as long as none of those objects has changed. Praat never gives
+// an ID out twice, so the results for a removed object are simply never
+// asked for again.
+//
+// Every object has a stamp, the value of changeClock when it last changed,
+// and every result the value when it was asked for. An object counts as
+// changed (see scripting.h) when
+//  - a command that is not in pureQueries is run by title while it is
+//    selected, by Python or by a Praat script: praat_doAction and
+//    praat_doMenuCommand tell us (see praat-py.patch), as does
+//    scripting_executePreparedCommand;
+//  - it is passed to a praat.direct function;
+//  - getArray(view=True) gives Python a view of its numbers, after which it
+//    counts as changed for good, since Python can write to them at any time.
+// Changes made by hand in an editor window are not seen.
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <wchar.h>
+
+#include <Python.h>
+
+#include "util.h"
+#include "scripting.h"
+#include "querycache.h"
+
+#define MAX_CACHED_RESULTS 65536
+#define MAX_KEY_OBJECTS 16   // queries on more selected objects than this are not cached
+#define FOREVER LONG_MAX
+
+int scripting_queryCaching = 0;
+
+static PyObject *results = NULL;   // {(kind, command line, id, ...): (result, stamp)}
+static long hits = 0, misses = 0, stale = 0;
+static int scriptDepth = 0;
+
+/* The queries. */
+
+static const wchar_t *pureQueries[] = {
+	// Anything with a time domain, and sampled data.
+	L"Get start time", L"Get end time", L"Get total duration",
+	L"Get number of frames", L"Get time step", L"Get time from frame number...", L"Get frame number from time...",
+	// Sound.
+	L"Get number of samples", L"Get sampling period", L"Get sampling frequency", L"Get number of channels",
+	L"Get time from sample number...", L"Get sample number from time...",
+	L"Get value at time...", L"Get value at sample number...", L"Get value in frame...",
+	L"Get minimum...", L"Get maximum...", L"Get time of minimum...", L"Get time of maximum...",
+	L"Get absolute extremum...", L"Get mean...", L"Get root-mean-square...", L"Get standard deviation...",
+	L"Get energy...", L"Get power...", L"Get energy in air", L"Get power in air", L"Get intensity (dB)",
+	L"Get nearest zero crossing...", L"Get quantile...",
+	// TextGrid and its tiers.
+	L"Get number of tiers", L"Get tier name...", L"Is interval tier...",
+	L"Get number of intervals...", L"Get starting point...", L"Get start point...", L"Get end point...",
+	L"Get label of interval...", L"Get interval at time...",
+	L"Get number of points...", L"Get time of point...", L"Get label of point...",
+	L"Get low index from time...", L"Get high index from time...", L"Get nearest index from time...",
+	L"Count labels...",
+	// Pitch, Formant, PointProcess.
+	L"Count voiced frames", L"Get mean absolute slope...", L"Get slope without octave jumps",
+	L"Get number of formants...", L"Get minimum number of formants", L"Get maximum number of formants",
+	L"Get bandwidth at time...",
+	L"Get number of points", L"Get low index...", L"Get high index...", L"Get nearest index...",
+	L"Get time from index...", L"Get jitter (local)...",
+	// Spectrum.
+	L"Get lowest frequency", L"Get highest frequency", L"Get number of bins", L"Get bin width",
+	L"Get frequency from bin number...", L"Get bin number from frequency...",
+	L"Get centre of gravity...", L"Get skewness...", L"Get kurtosis...", L"Get central moment...",
+	L"Get band energy...",
+	// Matrix and Table.
+	L"Get lowest x", L"Get highest x", L"Get lowest y", L"Get highest y",
+	L"Get number of rows", L"Get number of columns", L"Get row distance", L"Get column distance",
+	L"Get x of column...", L"Get y of row...", L"Get value in cell...", L"Get sum",
+	L"Get column label...", L"Get column index...", L"Get value...", L"Search column...",
+	NULL
+};
+
+static const wchar_t **querySlots = NULL;   // pureQueries by title hash
+static long numberOfQuerySlots = 0;
+
+static unsigned long hash_title(const wchar_t *title, long length) {
+	unsigned long hash = 2166136261UL;
+	long i;
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned long)title[i];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+int scripting_isPureQuery(const wchar_t *title, long length) {
+	// Whether the first length characters of title are one of pureQueries.
+	unsigned long slot;
+	if (!querySlots) {
+		long i;
+		for (i = 0; pureQueries[i]; i++) { }
+		for (numberOfQuerySlots = 64; numberOfQuerySlots < 4 * i; numberOfQuerySlots *= 2) { }
+		if (!(querySlots = (const wchar_t**)calloc(numberOfQuerySlots, sizeof(wchar_t*))))
+			return 0;
+		for (i = 0; pureQueries[i]; i++) {
+			slot = hash_title(pureQueries[i], wcslen(pureQueries[i])) & (numberOfQuerySlots - 1);
+			while (querySlots[slot])
+				slot = (slot + 1) & (numberOfQuerySlots - 1);
+			querySlots[slot] = pureQueries[i];
+		}
+	}
+	slot = hash_title(title, length) & (numberOfQuerySlots - 1);
+	for (; querySlots[slot]; slot = (slot + 1) & (numberOfQuerySlots - 1))
+		if (wcsncmp(querySlots[slot], title, length) == 0 && querySlots[slot][length] == 0)
+			return 1;
+	return 0;
+}
+
+/* The stamps of the objects that have changed, by ID. Objects that aren't
+ * here haven't changed since the cache was last emptied. */
+
+typedef struct {
+	long id, stamp;   // id 0 is an empty slot
+} Stamp;
+
+static long changeClock = 0, everythingChanged = 0;
+static Stamp *stamps = NULL;
+static long numberOfStamps = 0, numberOfStampSlots = 0;
+
+static long stamp_of(long id) {
+	unsigned long slot;
+	if (!stamps)
+		return 0;
+	for (slot = (unsigned long)id * 2654435761UL & (numberOfStampSlots - 1); stamps[slot].id;
+		slot = (slot + 1) & (numberOfStampSlots - 1))
+	{
+		if (stamps[slot].id == id)
+			return stamps[slot].stamp;
+	}
+	return 0;
+}
+
+static void set_stamp(long id, long stamp) {
+	unsigned long slot;
+	if (2 * (numberOfStamps + 1) > numberOfStampSlots) {
+		// Grow, leaving out objects that have been removed.
+		long i, oldSlots = numberOfStampSlots;
+		Stamp *old = stamps;
+		numberOfStampSlots = oldSlots ? 2 * oldSlots : 256;
+		if (!(stamps = (Stamp*)calloc(numberOfStampSlots, sizeof(Stamp)))) {
+			// Without room to remember which objects changed, say they all did.
+			stamps = old;
+			numberOfStampSlots = oldSlots;
+			everythingChanged = stamp;
+			return;
+		}
+		numberOfStamps = 0;
+		for (i = 0; i < oldSlots; i++)
+			if (old[i].id && scripting_objectExists(old[i].id))
+				set_stamp(old[i].id, old[i].stamp);
+		free(old);
+	}
+	for (slot = (unsigned long)id * 2654435761UL & (numberOfStampSlots - 1); stamps[slot].id;
+		slot = (slot + 1) & (numberOfStampSlots - 1))
+	{
+		if (stamps[slot].id == id) {
+			if (stamps[slot].stamp != FOREVER)
+				stamps[slot].stamp = stamp;
+			return;
+		}
+	}
+	stamps[slot].id = id;
+	stamps[slot].stamp = stamp;
+	numberOfStamps++;
+}
+
+void scripting_queryCacheChanged(long id, int forever) {
+	// The object with this ID may have changed, or if forever is set, may
+	// change at any time from now on.
+	if (!scripting_queryCaching)
+		return;
+	set_stamp(id, forever ? FOREVER : ++changeClock);
+}
+
+void scripting_queryCacheCommand(const wchar_t *title) {
+	// A command is about to run on the selected objects. Unless it is a
+	// query, it may change them.
+	long ids [MAX_KEY_OBJECTS], n, i;
+	if (!scripting_queryCaching || scripting_isPureQuery(title, wcslen(title)))
+		return;
+	n = scripting_getSelectedIds(ids, MAX_KEY_OBJECTS);
+	if (n > MAX_KEY_OBJECTS) {
+		everythingChanged = ++changeClock;
+		return;
+	}
+	for (i = 0; i < n; i++)
+		scripting_queryCacheChanged(ids[i], 0);
+}
+
+/* The results. */
+
+static void empty() {
+	if (results)
+		PyDict_Clear(results);
+	free(stamps);
+	stamps = NULL;
+	numberOfStamps = numberOfStampSlots = 0;
+	changeClock = everythingChanged = 0;
+}
+
+int querycache_lookup(querycache_Query *query, const wchar_t *title, long titleLength, const wchar_t *arguments) {
+	// Whether the result of the command with the given title (its first
+	// titleLength characters) and arguments is in the cache, in which case
+	// it is in query->cached. If it isn't but is to be cached once the
+	// command has run, query->key is set for querycache_store.
+	long ids [MAX_KEY_OBJECTS], n, i;
+	size_t length, mark;
+	wchar_t *command;
+	PyObject *key, *entry;
+
+	query->key = query->cached = NULL;
+	if (!scripting_queryCaching || !scripting_isPureQuery(title, titleLength))
+		return 0;
+	if ((n = scripting_getSelectedIds(ids, MAX_KEY_OBJECTS)) > MAX_KEY_OBJECTS)
+		return 0;
+	if (!results && !(results = PyDict_New())) {
+		PyErr_Clear();
+		return 0;
+	}
+	if (!(key = PyTuple_New(n + 2))) {
+		PyErr_Clear();
+		return 0;
+	}
+	// The command line, as praat_executeCommand would see it.
+	mark = arena_mark();
+	length = wcslen(arguments);
+	if ((command = (wchar_t*)arena_alloc((titleLength + length + 2) * sizeof(wchar_t)))) {
+		wmemcpy(command, title, titleLength);
+		command[titleLength] = ' ';
+		wmemcpy(command + titleLength + 1, arguments, length);
+		PyTuple_SET_ITEM(key, 1, PyUnicode_FromWideChar(command, length ? titleLength + 1 + (long)length : titleLength));
+	}
+	arena_release(mark);
+	PyTuple_SET_ITEM(key, 0, PyInt_FromLong(query->kind));
+	for (i = 0; i < n; i++)
+		PyTuple_SET_ITEM(key, i + 2, PyInt_FromLong(ids[i]));
+	for (i = 0; i < n + 2; i++) {
+		if (!PyTuple_GET_ITEM(key, i)) {
+			PyErr_Clear();
+			Py_DECREF(key);
+			return 0;
+		}
+	}
+
+	if ((entry = PyDict_GetItem(results, key))) {
+		long stamp = PyInt_AS_LONG(PyTuple_GET_ITEM(entry, 1));
+		for (i = 0; i < n && stamp_of(ids[i]) <= stamp; i++) { }
+		if (i == n && everythingChanged <= stamp) {
+			hits++;
+			query->cached = PyTuple_GET_ITEM(entry, 0);
+			Py_INCREF(query->cached);
+			Py_DECREF(key);
+			return 1;
+		}
+		stale++;
+	}
+	misses++;
+	query->key = key;
+	query->stamp = changeClock;
+	return 0;
+}
+
+PyObject *querycache_store(querycache_Query *query, PyObject *result) {
+	// Keep the result of a command that querycache_lookup didn't find, if
+	// there is one (not an error), and pass it on.
+	if (query->key && result && !PyErr_Occurred()) {
+		PyObject *entry = Py_BuildValue("(Ol)", result, query->stamp);
+		if (PyDict_Size(results) >= MAX_CACHED_RESULTS)
+			PyDict_Clear(results);
+		if (!entry || PyDict_SetItem(results, query->key, entry) == -1)
+			PyErr_Clear();
+		Py_XDECREF(entry);
+	}
+	Py_CLEAR(query->key);
+	return result;
+}
+
+void querycache_scriptBegin() {
+	// Called when a Python script starts, and querycache_scriptEnd when it
+	// ends. Nested scripts share the cache of the outer one.
+	const char *on = getenv("PRAATPY_QUERY_CACHE");
+	if (scriptDepth++ > 0)
+		return;
+	empty();
+	hits = misses = stale = 0;
+	scripting_queryCaching = on && *on && strcmp(on, "0") != 0;
+}
+
+void querycache_scriptEnd() {
+	if (scriptDepth > 0)
+		scriptDepth--;
+}
+
+void querycache_enable(int on) {
+	// Turning the cache off empties it, since changes aren't followed
+	// while it is off.
+	if (!on)
+		empty();
+	scripting_queryCaching = on;
+}
+
+void querycache_forget() {
+	// Called just before the interpreter is shut down.
+	empty();
+	Py_CLEAR(results);
+}
+
+PyObject *querycache_stats() {
+	// {'hits': queries answered from the cache, 'misses': queries run,
+	// 'stale': of those, how many were in the cache but for objects that
+	// had changed since, 'entries': results in the cache now}.
+	return Py_BuildValue("{s:l,s:l,s:l,s:l}", "hits", hits, "misses", misses, "stale", stale,
+		"entries", results ? (long)PyDict_Size(results) : 0L);
+}
@@ -0,0 +1,21 @@
+// The cache of query results in querycache.c, used by python.c.
+
+#define QUERYCACHE_NUMBER 0
+#define QUERYCACHE_STRING 1
+
+/* One getNum or getString call. Set kind and the rest to zero; after
+ * querycache_lookup, cached is the result if it was in the cache, and
+ * otherwise key is set if the result is to be kept. */
+typedef struct {
+	int kind;
+	PyObject *key, *cached;
+	long stamp;
+} querycache_Query;
+
+int querycache_lookup(querycache_Query *query, const wchar_t *title, long titleLength, const wchar_t *arguments);
+PyObject *querycache_store(querycache_Query *query, PyObject *result);
+void querycache_scriptBegin();
+void querycache_scriptEnd();
+void querycache_enable(int on);
+void querycache_forget();
+PyObject *querycache_stats();
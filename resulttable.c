@@ -0,0 +1,605 @@
+// This file implements praat.ResultTable, a table of measurements that
+// a script fills in row by row (or many rows at a time) and then writes
+// out or turns into a Praat Table, instead of printing each row to the
+// Info window and parsing the text afterwards.
+//
+// Each column has a type: 'f' for numbers (doubles; None is stored as
+// NaN), 'i' for integers (64-bit) or 's' for strings (kept as UTF-8).
+// The values of a column are kept together in one array that grows as
+// rows are added.
+//
+// writeBinary writes a file made of:
+//    the 8 bytes "PRPYTBL1"
+//    the number of columns (int32) and of rows (int64)
+//    for each column, its type (1 byte), the length of its name (int32)
+//      and the name (UTF-8)
+//    for each column, its values: doubles or int64s, or for a string
+//      column the length (int32) and bytes (UTF-8) of each string
+// with all numbers in the machine's byte order (little-endian on the
+// platforms Praat-Py is built for). A numpy column can be read with
+// numpy.frombuffer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <wchar.h>
+
+#include <Python.h>
+#include <structmember.h>
+
+#include "util.h"
+#include "scripting.h"
+#include "resulttable.h"
+
+typedef struct {
+	char *name;   // UTF-8
+	char type;   // 'f', 'i' or 's'
+	void *data;   // double *, long long * or char **
+} ResultColumn;
+
+typedef struct {
+	PyObject_HEAD
+	int numberOfColumns;
+	ResultColumn *columns;
+	long numberOfRows, capacity;
+} praatpy_ResultTable;
+
+static size_t value_size(char type) {
+	return type == 'f' ? sizeof(double) : type == 'i' ? sizeof(long long) : sizeof(char *);
+}
+
+static int grow(praatpy_ResultTable *self, long extra) {
+	// Make room for extra more rows.
+	long capacity = self->capacity ? self->capacity : 16;
+	int i;
+	while (capacity < self->numberOfRows + extra)
+		capacity *= 2;
+	if (capacity == self->capacity)
+		return 0;
+	for (i = 0; i < self->numberOfColumns; i++) {
+		void *data = realloc(self->columns[i].data, capacity * value_size(self->columns[i].type));
+		if (!data) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		self->columns[i].data = data;
+	}
+	self->capacity = capacity;
+	return 0;
+}
+
+static char *utf8_string(PyObject *value) {
+	// Return a newly allocated UTF-8 copy of a str, unicode or anything
+	// else's str().
+	PyObject *str;
+	char *ret;
+	if (PyString_Check(value)) {
+		str = value;
+		Py_INCREF(str);
+	} else if (PyUnicode_Check(value)) {
+		str = PyUnicode_AsUTF8String(value);
+	} else {
+		str = PyObject_Str(value);
+	}
+	if (!str)
+		return NULL;
+	ret = strdup(PyString_AsString(str));
+	Py_DECREF(str);
+	if (!ret)
+		PyErr_NoMemory();
+	return ret;
+}
+
+static int set_value(ResultColumn *column, long row, PyObject *value) {
+	// Store value in the given row of column, which has room for it.
+	// Returns -1 with an exception set if it has the wrong type.
+	if (column->type == 'f') {
+		double x = value == Py_None ? NAN : PyFloat_AsDouble(value);
+		if (x == -1.0 && PyErr_Occurred())
+			return -1;
+		((double *)column->data)[row] = x;
+	} else if (column->type == 'i') {
+		long long x = PyLong_AsLongLong(value);
+		if (x == -1 && PyErr_Occurred())
+			return -1;
+		((long long *)column->data)[row] = x;
+	} else {
+		char *x = utf8_string(value);
+		if (!x)
+			return -1;
+		((char **)column->data)[row] = x;
+	}
+	return 0;
+}
+
+static void free_strings(praatpy_ResultTable *self, long fromRow, long toRow, int numberOfColumns) {
+	// Free the strings in the first numberOfColumns columns of rows
+	// [fromRow, toRow), e.g. of rows that could not be added after all.
+	int i;
+	long row;
+	for (i = 0; i < numberOfColumns; i++)
+		if (self->columns[i].type == 's')
+			for (row = fromRow; row < toRow; row++)
+				free(((char **)self->columns[i].data)[row]);
+}
+
+static void praatpy_ResultTable_dealloc(PyObject *obj) {
+	praatpy_ResultTable *self = (praatpy_ResultTable*)obj;
+	int i;
+	free_strings(self, 0, self->numberOfRows, self->numberOfColumns);
+	for (i = 0; i < self->numberOfColumns; i++) {
+		free(self->columns[i].name);
+		free(self->columns[i].data);
+	}
+	free(self->columns);
+	obj->ob_type->tp_free(obj);
+}
+
+static int praatpy_ResultTable_init(praatpy_ResultTable *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"names", "types", NULL};
+	PyObject *names, *fast;
+	const char *types = NULL;
+	int i, n;
+
+	if (self->columns) {
+		PyErr_SetString(g_PrPyExc, "A ResultTable can only be set up once.");
+		return -1;
+	}
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|s", kwlist, &names, &types))
+		return -1;
+	if (PyString_Check(names) || PyUnicode_Check(names) || !(fast = PySequence_Fast(names, ""))) {
+		PyErr_Clear();
+		PyErr_SetString(g_PrPyExc, "The column names must be given as a list of strings.");
+		return -1;
+	}
+	n = PySequence_Fast_GET_SIZE(fast);
+	if (types && (int)strlen(types) != n) {
+		Py_DECREF(fast);
+		PyErr_SetString(g_PrPyExc, "There must be one type for each column.");
+		return -1;
+	}
+	if (types && strspn(types, "fis") != strlen(types)) {
+		Py_DECREF(fast);
+		PyErr_SetString(g_PrPyExc, "Column types must be 'f' (number), 'i' (integer) or 's' (string).");
+		return -1;
+	}
+
+	if (!(self->columns = (ResultColumn*)calloc(n ? n : 1, sizeof(ResultColumn)))) {
+		Py_DECREF(fast);
+		PyErr_NoMemory();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		self->columns[i].type = types ? types[i] : 'f';
+		if (!(self->columns[i].name = utf8_string(PySequence_Fast_GET_ITEM(fast, i)))) {
+			// Not set up after all, so that the table can be set up again.
+			while (i-- > 0)
+				free(self->columns[i].name);
+			free(self->columns);
+			self->columns = NULL;
+			self->numberOfColumns = 0;
+			Py_DECREF(fast);
+			return -1;
+		}
+		self->numberOfColumns = i + 1;
+	}
+	Py_DECREF(fast);
+	return 0;
+}
+
+static PyObject *praatpy_ResultTable_append(praatpy_ResultTable *self, PyObject *args) {
+	int i;
+	if (PyTuple_Size(args) != self->numberOfColumns) {
+		PyErr_Format(g_PrPyExc, "append() takes one value for each of the %d columns.", self->numberOfColumns);
+		return NULL;
+	}
+	if (grow(self, 1) == -1)
+		return NULL;
+	for (i = 0; i < self->numberOfColumns; i++) {
+		if (set_value(&self->columns[i], self->numberOfRows, PyTuple_GET_ITEM(args, i)) == -1) {
+			free_strings(self, self->numberOfRows, self->numberOfRows + 1, i);
+			return NULL;
+		}
+	}
+	self->numberOfRows++;
+	return Py_BuildValue("");
+}
+
+static int extend_column(ResultColumn *column, long row, long n, PyObject *values) {
+	// Fill rows [row, row + n) of column from values, a buffer of doubles
+	// or integers of the column's type, or else any sequence. On failure,
+	// returns -1 with no strings left allocated.
+	Py_buffer view;
+	PyObject *fast;
+	long i;
+
+	if (column->type != 's' && PyObject_CheckBuffer(values)
+		&& PyObject_GetBuffer(values, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+		const char *format = view.format ? view.format : "B";
+		if (format[0] && strchr("@=<", format[0]))
+			format++;
+		if (view.ndim == 1 && view.len == (Py_ssize_t)(n * view.itemsize) && view.itemsize == 8
+			&& (column->type == 'f' ? strcmp(format, "d") == 0 : (strcmp(format, "q") == 0 || (strcmp(format, "l") == 0 && sizeof(long) == 8)))) {
+			memcpy((char *)column->data + row * 8, view.buf, n * 8);
+			PyBuffer_Release(&view);
+			return 0;
+		}
+		PyBuffer_Release(&view);
+	}
+	PyErr_Clear();
+
+	if (!(fast = PySequence_Fast(values, "The columns must be given as sequences or arrays."))) {
+		return -1;
+	}
+	if (PySequence_Fast_GET_SIZE(fast) != n) {
+		Py_DECREF(fast);
+		PyErr_SetString(g_PrPyExc, "All columns must have the same length.");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (set_value(column, row + i, PySequence_Fast_GET_ITEM(fast, i)) == -1) {
+			if (column->type == 's')
+				while (i-- > 0)
+					free(((char **)column->data)[row + i]);
+			Py_DECREF(fast);
+			return -1;
+		}
+	}
+	Py_DECREF(fast);
+	return 0;
+}
+
+static PyObject *praatpy_ResultTable_extend(praatpy_ResultTable *self, PyObject *args) {
+	int i;
+	Py_ssize_t n;
+	if (PyTuple_Size(args) != self->numberOfColumns) {
+		PyErr_Format(g_PrPyExc, "extend() takes one sequence or array for each of the %d columns.", self->numberOfColumns);
+		return NULL;
+	}
+	if (self->numberOfColumns == 0)
+		return Py_BuildValue("");
+	if ((n = PyObject_Length(PyTuple_GET_ITEM(args, 0))) == -1)
+		return NULL;
+	if (grow(self, n) == -1)
+		return NULL;
+	for (i = 0; i < self->numberOfColumns; i++) {
+		if (extend_column(&self->columns[i], self->numberOfRows, n, PyTuple_GET_ITEM(args, i)) == -1) {
+			free_strings(self, self->numberOfRows, self->numberOfRows + n, i);
+			return NULL;
+		}
+	}
+	self->numberOfRows += n;
+	return Py_BuildValue("");
+}
+
+static int column_index(praatpy_ResultTable *self, PyObject *key) {
+	// The column given by its number or name, or -1 with an exception set.
+	int i;
+	if (PyInt_Check(key) || PyLong_Check(key)) {
+		long k = PyInt_AsLong(key);
+		if (k < 0)
+			k += self->numberOfColumns;
+		if (k >= 0 && k < self->numberOfColumns)
+			return k;
+	} else {
+		char *name = utf8_string(key);
+		if (!name)
+			return -1;
+		for (i = 0; i < self->numberOfColumns; i++)
+			if (strcmp(self->columns[i].name, name) == 0)
+				break;
+		free(name);
+		if (i < self->numberOfColumns)
+			return i;
+	}
+	PyErr_SetString(PyExc_KeyError, "No such column.");
+	return -1;
+}
+
+static PyObject *praatpy_ResultTable_column(praatpy_ResultTable *self, PyObject *key) {
+	int i = column_index(self, key);
+	long row;
+	PyObject *ret;
+	if (i == -1)
+		return NULL;
+	if (!(ret = PyList_New(self->numberOfRows)))
+		return NULL;
+	for (row = 0; row < self->numberOfRows; row++) {
+		PyObject *item;
+		ResultColumn *column = &self->columns[i];
+		if (column->type == 'f')
+			item = PyFloat_FromDouble(((double *)column->data)[row]);
+		else if (column->type == 'i')
+			item = PyLong_FromLongLong(((long long *)column->data)[row]);
+		else
+			item = PyUnicode_DecodeUTF8(((char **)column->data)[row], strlen(((char **)column->data)[row]), "replace");
+		if (!item) {
+			Py_DECREF(ret);
+			return NULL;
+		}
+		PyList_SET_ITEM(ret, row, item);
+	}
+	return ret;
+}
+
+/* The whole file is put together in memory and written with one fwrite.
+ * If the buffer can't grow, the rest is skipped and write_file raises
+ * MemoryError without touching the file. */
+
+typedef struct {
+	char *data;
+	size_t length, capacity;
+	int failed;
+} OutputBuffer;
+
+static int reserve(OutputBuffer *out, size_t extra) {
+	size_t capacity = out->capacity;
+	char *data;
+	if (out->failed)
+		return 0;
+	if (out->length + extra <= capacity)
+		return 1;
+	while (out->length + extra > capacity)
+		capacity = capacity ? 2 * capacity : 65536;
+	if (!(data = (char *)realloc(out->data, capacity))) {
+		out->failed = 1;
+		return 0;
+	}
+	out->data = data;
+	out->capacity = capacity;
+	return 1;
+}
+
+static void put(OutputBuffer *out, const void *data, size_t length) {
+	if (!reserve(out, length))
+		return;
+	memcpy(out->data + out->length, data, length);
+	out->length += length;
+}
+
+static PyObject *write_file(OutputBuffer *out, const char *path) {
+	FILE *f;
+	size_t written;
+	if (out->failed) {
+		free(out->data);
+		return PyErr_NoMemory();
+	}
+	f = fopen(path, "wb");
+	if (!f) {
+		free(out->data);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+	}
+	written = fwrite(out->data, 1, out->length, f);
+	free(out->data);
+	if (fclose(f) != 0 || written != out->length)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+	return Py_BuildValue("");
+}
+
+static void put_csv_string(OutputBuffer *out, const char *s, char delimiter) {
+	// Quote the string only if it needs it.
+	const char *p;
+	if (!strchr(s, delimiter) && !strpbrk(s, "\"\r\n")) {
+		put(out, s, strlen(s));
+		return;
+	}
+	put(out, "\"", 1);
+	for (p = s; *p; p++) {
+		if (*p == '"')
+			put(out, "\"", 1);
+		put(out, p, 1);
+	}
+	put(out, "\"", 1);
+}
+
+static void put_csv_number(OutputBuffer *out, double x) {
+	// The shortest of 15 or 17 digits that reads back as the same number.
+	// Undefined values are left empty.
+	char buffer [32];
+	int n;
+	if (isnan(x))
+		return;
+	n = sprintf(buffer, "%.15g", x);
+	if (strtod(buffer, NULL) != x)
+		n = sprintf(buffer, "%.17g", x);
+	put(out, buffer, n);
+}
+
+static PyObject *praatpy_ResultTable_writeCSV(praatpy_ResultTable *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"path", "delimiter", NULL};
+	const char *path;
+	char delimiter = ',';
+	OutputBuffer out = { NULL, 0, 0, 0 };
+	long row;
+	int i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|c", kwlist, &path, &delimiter))
+		return NULL;
+
+	for (i = 0; i < self->numberOfColumns; i++) {
+		if (i) put(&out, &delimiter, 1);
+		put_csv_string(&out, self->columns[i].name, delimiter);
+	}
+	put(&out, "\n", 1);
+	for (row = 0; row < self->numberOfRows; row++) {
+		for (i = 0; i < self->numberOfColumns; i++) {
+			ResultColumn *column = &self->columns[i];
+			if (i) put(&out, &delimiter, 1);
+			if (column->type == 'f') {
+				put_csv_number(&out, ((double *)column->data)[row]);
+			} else if (column->type == 'i') {
+				char buffer [32];
+				put(&out, buffer, sprintf(buffer, "%lld", ((long long *)column->data)[row]));
+			} else {
+				put_csv_string(&out, ((char **)column->data)[row], delimiter);
+			}
+		}
+		put(&out, "\n", 1);
+	}
+	return write_file(&out, path);
+}
+
+static void put_int32(OutputBuffer *out, int x) {
+	put(out, &x, 4);
+}
+
+static PyObject *praatpy_ResultTable_writeBinary(praatpy_ResultTable *self, PyObject *args) {
+	const char *path;
+	OutputBuffer out = { NULL, 0, 0, 0 };
+	long long rows = self->numberOfRows;
+	long row;
+	int i;
+
+	if (!PyArg_ParseTuple(args, "s", &path))
+		return NULL;
+
+	put(&out, "PRPYTBL1", 8);
+	put_int32(&out, self->numberOfColumns);
+	put(&out, &rows, 8);
+	for (i = 0; i < self->numberOfColumns; i++) {
+		put(&out, &self->columns[i].type, 1);
+		put_int32(&out, strlen(self->columns[i].name));
+		put(&out, self->columns[i].name, strlen(self->columns[i].name));
+	}
+	for (i = 0; i < self->numberOfColumns; i++) {
+		ResultColumn *column = &self->columns[i];
+		if (column->type != 's') {
+			put(&out, column->data, self->numberOfRows * 8);
+		} else {
+			for (row = 0; row < self->numberOfRows; row++) {
+				const char *s = ((char **)column->data)[row];
+				put_int32(&out, strlen(s));
+				put(&out, s, strlen(s));
+			}
+		}
+	}
+	return write_file(&out, path);
+}
+
+static PyObject *praatpy_ResultTable_toTable(praatpy_ResultTable *self, PyObject *args) {
+	PyObject *pyname = NULL;
+	scripting_TableColumn *columns;
+	wchar_t *name;
+	int i, hadError;
+	size_t mark;
+
+	if (!PyArg_ParseTuple(args, "|O", &pyname))
+		return NULL;
+	if (!(name = pyname ? object_name(pyname) : wcsdup(L"table")))
+		return NULL;
+
+	if (!(columns = (scripting_TableColumn*)calloc(self->numberOfColumns ? self->numberOfColumns : 1, sizeof(scripting_TableColumn)))) {
+		free(name);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < self->numberOfColumns; i++) {
+		columns[i].name = self->columns[i].name;
+		columns[i].type = self->columns[i].type;
+		columns[i].data = self->columns[i].data;
+	}
+	info_flush();
+	mark = arena_mark();
+	wchar_t *ret = scripting_createTable(columns, self->numberOfColumns, self->numberOfRows, name, &hadError);
+	free(columns);
+	free(name);
+	return created_object(ret, hadError, mark);
+}
+
+static Py_ssize_t praatpy_ResultTable_length(PyObject *self) {
+	return ((praatpy_ResultTable*)self)->numberOfRows;
+}
+
+static PyObject *praatpy_ResultTable_getnames(praatpy_ResultTable *self, void *closure) {
+	PyObject *ret = PyTuple_New(self->numberOfColumns);
+	int i;
+	if (!ret)
+		return NULL;
+	for (i = 0; i < self->numberOfColumns; i++) {
+		PyObject *name = PyUnicode_DecodeUTF8(self->columns[i].name, strlen(self->columns[i].name), "replace");
+		if (!name) {
+			Py_DECREF(ret);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(ret, i, name);
+	}
+	return ret;
+}
+
+static PyObject *praatpy_ResultTable_gettypes(praatpy_ResultTable *self, void *closure) {
+	PyObject *ret = PyString_FromStringAndSize(NULL, self->numberOfColumns);
+	int i;
+	if (!ret)
+		return NULL;
+	for (i = 0; i < self->numberOfColumns; i++)
+		PyString_AS_STRING(ret)[i] = self->columns[i].type;
+	return ret;
+}
+
+static PyMethodDef praatpy_ResultTable_Methods[] = {
+    {"append", (PyCFunction)praatpy_ResultTable_append, METH_VARARGS,
+     "append(value, ...) adds a row with one value for each column."},
+    {"extend", (PyCFunction)praatpy_ResultTable_extend, METH_VARARGS,
+     "extend(column, ...) adds many rows at once, given one sequence or array of values for each column."},
+    {"column", (PyCFunction)praatpy_ResultTable_column, METH_O,
+     "column(name or number) returns the values of a column as a list."},
+    {"writeCSV", (PyCFunction)praatpy_ResultTable_writeCSV, METH_VARARGS | METH_KEYWORDS,
+     "writeCSV(path, delimiter=',') writes the table as a text file with a header line."},
+    {"writeBinary", (PyCFunction)praatpy_ResultTable_writeBinary, METH_VARARGS,
+     "writeBinary(path) writes the table in Praat-Py's compact binary format (see resulttable.c)."},
+    {"toTable", (PyCFunction)praatpy_ResultTable_toTable, METH_VARARGS,
+     "toTable(name='table') adds a Praat Table with the contents of this table to the object list, selects it and returns it like go() does."},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef praatpy_ResultTable_GetSet[] = {
+    {"names", (getter)praatpy_ResultTable_getnames, NULL, "The names of the columns.", NULL},
+    {"types", (getter)praatpy_ResultTable_gettypes, NULL, "The types of the columns as a string like 'sff'.", NULL},
+    {NULL}
+};
+
+static PySequenceMethods praatpy_ResultTable_SequenceMethods = {
+    praatpy_ResultTable_length, /*sq_length*/
+};
+
+PyTypeObject praatpy_ResultTableObj = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "praat.ResultTable",       /*tp_name*/
+    sizeof(praatpy_ResultTable), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    praatpy_ResultTable_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &praatpy_ResultTable_SequenceMethods, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "ResultTable(names, types='ff...') is a table of measurements with typed columns ('f' number, 'i' integer, 's' string).", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    praatpy_ResultTable_Methods, /* tp_methods */
+    0,                         /* tp_members */
+    praatpy_ResultTable_GetSet, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)praatpy_ResultTable_init, /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
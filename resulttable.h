@@ -0,0 +1,9 @@
+// praat.ResultTable is in resulttable.c. python.c adds the type to the
+// praat module and shares these with it.
+
+extern PyTypeObject praatpy_ResultTableObj;
+
+extern PyObject *g_PrPyExc;
+wchar_t *object_name(PyObject *item);
+PyObject *created_object(wchar_t *ret, int hadError, size_t mark);
+void info_flush();
@@ -2,13 +2,22 @@
 // and our script interpreter.
 
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 #include <wchar.h>
 
 #include "../sys/melder.h"
 #include "../sys/praatP.h"
 #include "../sys/praat_script.h"
+#include "../num/NUM.h"
+#include "../fon/Sound.h"
+#include "../fon/LongSound.h"
+#include "../fon/Pitch.h"
+#include "../fon/Formant.h"
+#include "../stat/Table.h"
 
 #include "util.h"
+#include "transcode.h"
 #include "scripting.h"
 
 /* Interface from Python (C) into Praat (C++). */
@@ -16,117 +25,733 @@
 static Interpreter current_interpreter = NULL; // global state; bad programming style, yes
 
 extern "C" void scripting_executePraatCommand2(wchar_t *command) {
-	praat_executeCommand (current_interpreter, command);
+	try {
+		praat_executeCommand (current_interpreter, command);
+	} catch (MelderError) {
+		// The error message stays in Melder's error buffer, where
+		// our callers look for it with Melder_hasError.
+	}
+}
+
+/* Typed results. Melder_informationReal, which query commands like
+ * "Get end time" use to report their number, hands the number to
+ * scripting_reportReal (see praat-py.patch), so that getNum doesn't have
+ * to find it again in the formatted Info window text. */
+
+static int typed_result_armed = 0, typed_result_count = 0;
+static double typed_result_value;
+
+extern "C" void scripting_reportReal (double value) {
+	// Only the first number reported by the command counts, as with the
+	// text of the Info window.
+	if (!typed_result_armed || typed_result_count++ > 0)
+		return;
+	typed_result_value = value == NUMundefined ? NAN : value;
+}
+
+extern "C" int scripting_getTypedResult (double *value) {
+	// Whether the last command run with divert reported a number, and if so
+	// what it was.
+	if (typed_result_count == 0)
+		return 0;
+	*value = typed_result_value;
+	return 1;
+}
+
+/* A server (serve.cpp) captures the Info window for its client. What Praat
+ * writes to it is collected in captured, and handed to the sink, in order
+ * with what Python prints, after each command that isn't diverted and
+ * whenever Python passes its output on. error is set for what a Python
+ * script writes to sys.stderr. */
+
+static MelderString captured = { 0, 0, NULL };
+static void (*captureSink) (int error, const wchar_t *text) = NULL;
+
+static void flush_captured () {
+	if (captureSink && captured.length > 0) {
+		captureSink (0, captured.string);
+		MelderString_empty (& captured);
+	}
+}
+
+extern "C" void scripting_captureInfo (void (*sink) (int error, const wchar_t *text)) {
+	// Start capturing, or with sink NULL, stop. Either way, what has been
+	// captured so far goes to the old sink first.
+	flush_captured ();
+	captureSink = sink;
+	Melder_divertInfo (sink ? & captured : NULL);
+}
+
+extern "C" int scripting_capturingInfo () {
+	return captureSink != NULL;
+}
+
+/* The output of a command run with divert is collected in a MelderString
+ * that is kept between commands, so that its buffer is reused. A command run
+ * while another one's output is being diverted (by a script that the other
+ * command runs) gets a buffer of its own. */
+
+static MelderString diverted = { 0, 0, NULL };
+static int diversionDepth = 0;
+
+static MelderString *begin_diversion (MelderString *own) {
+	MelderString *value = diversionDepth ++ == 0 ? & diverted : own;
+	MelderString_empty (value);
+	Melder_divertInfo (value);
+	typed_result_armed = 1;
+	typed_result_count = 0;
+	return value;
+}
+
+static void end_diversion () {
+	typed_result_armed = 0;
+	diversionDepth --;
+	Melder_divertInfo (captureSink ? & captured : NULL);
 }
 
-extern "C" wchar_t *scripting_executePraatCommand (wchar_t **commandargs, int divert, int *haderror) {
-	// This runs a Praat Script command whose command and arguments are stored
-	// in the NULL-terminated commandargs array, which *this function* frees
-	// (along with its elements) once it's done using it.
+static void sample_memory ();
+
+static wchar_t *finish_command (MelderString *value, int *haderror) {
+	// Collect the error or the diverted output (if value is not NULL) of a
+	// command that has just run, as a string in the arena (see util.h).
+	// See scripting_executePraatCommand.
+	wchar_t *ret = NULL;
+	sample_memory ();
+	if (! value)
+		flush_captured ();
+	if (Melder_hasError()) {
+		*haderror = 1;
+		ret = arena_wcsdup (Melder_getError ());
+		Melder_clearError ();
+	} else {
+		*haderror = 0;
+		if (value) {
+			scripting_profileOutput (value->length * sizeof (wchar_t));
+			ret = arena_wcsdup (value->string ? value->string : L"");
+		}
+	}
+	if (value) {
+		if (value == & diverted)
+			MelderString_empty (value);
+		else
+			MelderString_free (value);
+	}
+	return ret;
+}
+
+extern "C" wchar_t *scripting_executePraatCommand (wchar_t *command, long titleLength, int divert, int *haderror) {
+	// This runs a Praat Script command line whose first titleLength
+	// characters are the command title, as put together by python.c.
 	//
 	// If divert is true, the output to the info window is diverted
-	// and captured, and returned by this function (as a newly-allocated buffer
-	// to be freed by the caller). haderror is set on returning to whether an
-	// error ocurred, and if so the error is returned as a newly allocated
-	// buffer. If no error occurs and divert is false, NULL is returned.
+	// and captured, and returned by this function. haderror is set on
+	// returning to whether an error ocurred, and if so the error is
+	// returned. Either is a string in the arena (see util.h), valid until
+	// the caller releases its mark. If no error occurs and divert is false,
+	// NULL is returned.
 	
-	MelderString value = { 0, 0, NULL };
+	MelderString own = { 0, 0, NULL }, *value = NULL;
 	
-	// Format the complete command. Concatenate the command and arguments
-	// by quote-escaping any of the arguments except the last one as needed.
-
-	// Compute the size of the command first so that we can allocate the
-	// complete buffer.
-	int command_size_max = 0;
-	wchar_t **arg = commandargs;
-	while (*arg) {
-		// For each command/argument, we allocate 3 extra characters
-		// for a space and surrounding quotes, and double the length
-		// of the string in case we have to escape quotes inside it
-		// by doubling them.
-		command_size_max += wcslen(*arg)*2 + 3;
-		arg++;
-	}
+	scripting_profileTitle (command, titleLength);
+	scripting_profilePhase (SCRIPTING_PROFILE_RUN);
 	
-	// Allocate the command buffer, copy the arguments in escaping as
-	// needed, and freeing the commandargs array and elements as we go
-	// through.
-	wchar_t *command = (wchar_t*)calloc(command_size_max, sizeof(wchar_t));
-	arg = commandargs;
-	while (*arg) {
-		// Before all but the first element, concat a space.
-		if (arg != commandargs)
-			wcscat(command, L" ");
-		
-		// If this is the first element (the command name) or the last
-		// element (the last argument, which Praat never escapes), then
-		// don't escape. Otherwise, see if we need to escape.
-		int escape = 0;
-		if (arg != commandargs && *(arg + 1)) {
-			// Contains a space or quote character?
-			if (wcsstr(*arg, L" ") || wcsstr(*arg, L"\""))
-				escape = 1;
-		}
-		
-		if (!escape) {
-			wcscat(command, *arg);
-		} else {
-			wcscat(command, L"\"");
-			int i;
-			for (i = 0; i < wcslen(*arg); i++) {
-				wcsncat(command, *arg + i, 1); // copy this character over
-				if ((*arg)[i] == '"') // escape the quote by doubling it
-					wcsncat(command, *arg + i, 1); // copy this character over
-			}
-			wcscat(command, L"\"");
-		}
-	
-		free(*arg);
-		arg++;
-	}
-	free(commandargs);
-	
-	if (divert) Melder_divertInfo (&value);
+	if (divert) value = begin_diversion (& own);
 	scripting_executePraatCommand2 (command);
-	if (divert) Melder_divertInfo (NULL);
-	
-	free(command);
+	if (divert) end_diversion ();
 	
-	if (Melder_hasError()) {
-		MelderString_free(&value);
-		*haderror = 1;
-		wchar_t *ret = wcsdup (Melder_getError ());
-		Melder_clearError ();
-		return ret;
+	return finish_command (value, haderror);
+}
+
+static praat_Command find_prepared_command (scripting_PreparedCommand *command) {
+	// Check that the entry we found last time is still the one to use.
+	// Which of several actions with the same title is executable depends
+	// on the selection, and the action table is reordered when actions
+	// are added, so we can't trust the index blindly.
+	praat_Command entry = NULL;
+	if (command->index > 0 && command->index <= praat_getNumberOfActions ())
+		entry = praat_getAction (command->index);
+	else if (command->index < 0 && - command->index <= praat_getNumberOfMenuCommands ())
+		entry = praat_getMenuCommand (- command->index);
+	if (entry && entry->executable && entry->callback && wcscmp (entry->title, command->title) == 0)
+		return entry;
+
+	// Look it up again the way praat_executeCommand would: first the
+	// actions, then the Objects and Picture window menus (cmdindex.cpp).
+	long i = scripting_findAction (command->title);
+	if (i) {
+		command->index = i;
+		return praat_getAction (i);
 	}
+	i = scripting_findMenuCommand (command->title);
+	command->index = - i;
+	return i ? praat_getMenuCommand (i) : NULL;
+}
+
+extern "C" wchar_t *scripting_executePreparedCommand (scripting_PreparedCommand *command, wchar_t *arguments, int divert, int *haderror) {
+	// Like scripting_executePraatCommand, but the command title is kept
+	// separately in a scripting_PreparedCommand and arguments holds only
+	// the arguments. The callback behind the title is called directly, so
+	// the command line is not parsed and the menus are not searched again.
 	
-	*haderror = 0;
+	MelderString own = { 0, 0, NULL }, *value = NULL;
+
+	scripting_profileTitle (command->title, -1);
+	scripting_profilePhase (SCRIPTING_PROFILE_RUN);
 	
-	if (divert) {
-		if (value.string) {
-			wchar_t *ret = wcsdup (value.string);
-			MelderString_free(&value);
-			return ret;
+	praat_Command entry = find_prepared_command (command);
+	if (entry == NULL) {
+		// Not a command for the current selection, or a directive like
+		// "select" or "echo". Let praat_executeCommand deal with it,
+		// including reporting the error.
+		long titleLength = wcslen (command->title), length = wcslen (arguments);
+		wchar_t *full = (wchar_t*)arena_alloc ((titleLength + length + 2) * sizeof (wchar_t));
+		wmemcpy (full, command->title, titleLength);
+		full [titleLength] = ' ';
+		wmemcpy (full + titleLength + 1, arguments, length + 1);
+		if (length == 0)
+			full [titleLength] = 0;
+
+		if (divert) value = begin_diversion (& own);
+		scripting_executePraatCommand2 (full);
+		if (divert) end_diversion ();
+	} else {
+		// This bypasses praat_doAction, which tells the query cache.
+		scripting_queryCacheCommand (command->title);
+		if (divert) value = begin_diversion (& own);
+		try {
+			entry->callback (NULL, arguments, current_interpreter, command->title, false, NULL);
+		} catch (MelderError) {
+			// Left in the error buffer for finish_command.
+		}
+		if (divert) end_diversion ();
+	}
+
+	return finish_command (value, haderror);
+}
+
+extern "C" void write_to_info_window(wchar_t *text) {
+	if (captureSink) {
+		flush_captured ();
+		captureSink (0, text);
+	} else {
+		Melder_print (text);
+	}
+}
+
+extern "C" void write_to_error_stream(wchar_t *text) {
+	// A Python script's sys.stderr, which is the Info window unless it is
+	// being captured.
+	if (captureSink) {
+		flush_captured ();
+		captureSink (1, text);
+	} else {
+		Melder_print (text);
+	}
+}
+
+static int find_object_by_id (long id, int *position) {
+	// Return the position in the object list of the object with this
+	// unique ID, or 0 if it has been removed. Objects are appended to
+	// the list as they are created and removal keeps the order, so IDs
+	// increase along the list. If position is given, it is where the
+	// object was last time, which is checked first; it is updated.
+	int n = theCurrentPraatObjects -> n;
+	if (position && *position >= 1 && *position <= n && theCurrentPraatObjects -> list [*position]. id == id)
+		return *position;
+	int lo = 1, hi = n;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		long midid = theCurrentPraatObjects -> list [mid]. id;
+		if (midid == id) {
+			if (position) *position = mid;
+			return mid;
+		}
+		if (midid < id)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return 0;
+}
+
+static int find_object (long id, const wchar_t *fullName) {
+	// Return the position in the object list of the object with the given
+	// ID if it is not 0, or else with the given full name ("Sound mysound"),
+	// the most recent one if there are several like Praat's select command
+	// does, or else of the only selected object. Return 0 if there is no
+	// such object.
+	if (id)
+		return find_object_by_id (id, NULL);
+	if (fullName == NULL) {
+		if (theCurrentPraatObjects -> totalSelection != 1)
+			return 0;
+		for (int i = 1; i <= theCurrentPraatObjects -> n; i ++)
+			if (theCurrentPraatObjects -> list [i]. isSelected)
+				return i;
+		return 0;
+	}
+	for (int i = theCurrentPraatObjects -> n; i >= 1; i --)
+		if (wcscmp (theCurrentPraatObjects -> list [i]. name, fullName) == 0)
+			return i;
+	return 0;
+}
+
+extern "C" int scripting_findObject (long id, int *position) {
+	return find_object_by_id (id, position);
+}
+
+extern "C" int scripting_objectExists (long id) {
+	return find_object_by_id (id, NULL) != 0;
+}
+
+extern "C" long scripting_getSelectedObject (int *position) {
+	// The ID of the first selected object, or 0 if nothing is selected.
+	for (int i = 1; i <= theCurrentPraatObjects -> n; i ++) {
+		if (theCurrentPraatObjects -> list [i]. isSelected) {
+			*position = i;
+			return theCurrentPraatObjects -> list [i]. id;
+		}
+	}
+	return 0;
+}
+
+extern "C" const wchar_t *scripting_getObjectName (long id, int *position) {
+	// The full name ("Sound mysound") of the object, owned by Praat, or
+	// NULL if the object has been removed.
+	int i = find_object_by_id (id, position);
+	return i ? theCurrentPraatObjects -> list [i]. name : NULL;
+}
+
+extern "C" int scripting_selectObject (long id, int *position, int mode) {
+	// Select only this object (mode 0), add it to the selection (1), or
+	// remove it from the selection (2). Returns 0 if the object has been
+	// removed.
+	int i = find_object_by_id (id, position);
+	if (i == 0)
+		return 0;
+	if (mode == 0)
+		praat_deselectAll ();
+	if (mode == 2)
+		praat_deselect (i);
+	else
+		praat_select (i);
+	praat_show ();
+	return 1;
+}
+
+static int compare_ids (const void *a, const void *b) {
+	long x = * (const long *) a, y = * (const long *) b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static long find_objects (long *ids, long n, int *positions) {
+	// Sort ids and fill in the position of each in the object list, in one
+	// pass over the list, which is ordered by ID. Returns the number of
+	// IDs that were not found; their positions are 0.
+	qsort (ids, n, sizeof (long), compare_ids);
+	long k = 0, missing = 0;
+	for (int i = 1; i <= theCurrentPraatObjects -> n && k < n; i ++) {
+		long id = theCurrentPraatObjects -> list [i]. id;
+		while (k < n && ids [k] < id) {
+			positions [k ++] = 0;
+			missing ++;
+		}
+		while (k < n && ids [k] == id)   // the same object may be given twice
+			positions [k ++] = i;
+	}
+	missing += n - k;
+	while (k < n)
+		positions [k ++] = 0;
+	return missing;
+}
+
+extern "C" long scripting_selectObjects (long *ids, long n, int mode) {
+	// Select only these objects (mode 0), add them to the selection (1)
+	// or remove them from it (2), updating the menus once. ids is sorted
+	// in place. If any of the objects has been removed, the selection is
+	// not changed and the ID of one of them is returned; otherwise 0, or
+	// -1 if there is no memory.
+	int *positions = (int*) malloc ((n + 1) * sizeof (int));
+	if (! positions)
+		return -1;
+	if (find_objects (ids, n, positions) > 0) {
+		long missing = 0;
+		for (long k = 0; k < n && ! missing; k ++)
+			if (positions [k] == 0) missing = ids [k];
+		free (positions);
+		return missing;
+	}
+	if (mode == 0)
+		praat_deselectAll ();
+	for (long k = 0; k < n; k ++) {
+		if (mode == 2)
+			praat_deselect (positions [k]);
+		else
+			praat_select (positions [k]);
+	}
+	free (positions);
+	praat_show ();
+	return 0;
+}
+
+extern "C" long scripting_removeObjects (long *ids, long n) {
+	// Remove all these objects, updating the menus once. Returns as
+	// scripting_selectObjects does.
+	int *positions = (int*) malloc ((n + 1) * sizeof (int));
+	if (! positions)
+		return -1;
+	if (find_objects (ids, n, positions) > 0) {
+		long missing = 0;
+		for (long k = 0; k < n && ! missing; k ++)
+			if (positions [k] == 0) missing = ids [k];
+		free (positions);
+		return missing;
+	}
+	// From the back, so that the positions still to do don't move.
+	for (long k = n - 1; k >= 0; k --)
+		if (k == n - 1 || positions [k] != positions [k + 1])
+			praat_removeObject (positions [k]);
+	free (positions);
+	praat_show ();
+	return 0;
+}
+
+extern "C" int scripting_removeObject (long id, int *position) {
+	// Remove the object from the list. Returns 0 if it was already gone.
+	int i = find_object_by_id (id, position);
+	if (i == 0)
+		return 0;
+	praat_removeObject (i);
+	praat_show ();
+	return 1;
+}
+
+extern "C" long scripting_lastObjectId () {
+	// The ID of the most recently created object, removed or not. Objects
+	// created from now on get higher IDs.
+	return theCurrentPraatObjects -> uniqueId;
+}
+
+extern "C" long scripting_getSelectedIds (long *ids, long max) {
+	// Fill in the IDs of the selected objects, lowest first, up to max of
+	// them, and return how many objects are selected. The selection is
+	// usually among the newest objects, so the list is searched backwards.
+	long n = theCurrentPraatObjects -> totalSelection, k = n;
+	for (int i = theCurrentPraatObjects -> n; i >= 1 && k > 0; i --)
+		if (theCurrentPraatObjects -> list [i]. isSelected && -- k < max)
+			ids [k] = theCurrentPraatObjects -> list [i]. id;
+	return n;
+}
+
+extern "C" long scripting_removeObjectsAfter (long id, const long *keep, long numberKept) {
+	// Remove every object with an ID higher than id, except those whose IDs
+	// are in keep, updating the menus once. Returns how many were removed.
+	long removed = 0;
+	for (int i = theCurrentPraatObjects -> n; i >= 1 && theCurrentPraatObjects -> list [i]. id > id; i --) {
+		long k;
+		for (k = 0; k < numberKept && keep [k] != theCurrentPraatObjects -> list [i]. id; k ++) { }
+		if (k < numberKept)
+			continue;
+		praat_removeObject (i);
+		removed ++;
+	}
+	if (removed)
+		praat_show ();
+	return removed;
+}
+
+/* Memory accounting for praat.memory(). An object's size is estimated from
+ * the numbers it holds; other objects count the size of their structure. */
+
+static long peakObjects = 0, lastSampledId = -1;
+static double peakBytes = 0;
+
+static double object_bytes (Data object) {
+	if (Thing_member (object, classMatrix)) {
+		Matrix me = (Matrix) object;
+		return my classInfo -> size + (double) my nx * my ny * sizeof (double) + my ny * sizeof (double *);
+	} else if (Thing_member (object, classPitch)) {
+		Pitch me = (Pitch) object;
+		double bytes = my classInfo -> size + (double) my nx * sizeof (structPitch_Frame);
+		for (long iframe = 1; iframe <= my nx; iframe ++)
+			bytes += my frame [iframe]. nCandidates * sizeof (structPitch_Candidate);
+		return bytes;
+	} else if (Thing_member (object, classFormant)) {
+		Formant me = (Formant) object;
+		double bytes = my classInfo -> size + (double) my nx * sizeof (structFormant_Frame);
+		for (long iframe = 1; iframe <= my nx; iframe ++)
+			bytes += my frame [iframe]. nFormants * sizeof (structFormant_Formant);
+		return bytes;
+	}
+	return object -> classInfo -> size;
+}
+
+static void sample_memory () {
+	// Update the high-water marks if objects have been created since the
+	// last time.
+	if (theCurrentPraatObjects -> uniqueId == lastSampledId)
+		return;
+	lastSampledId = theCurrentPraatObjects -> uniqueId;
+	double bytes = 0;
+	for (int i = 1; i <= theCurrentPraatObjects -> n; i ++)
+		bytes += object_bytes (theCurrentPraatObjects -> list [i]. object);
+	if (theCurrentPraatObjects -> n > peakObjects)
+		peakObjects = theCurrentPraatObjects -> n;
+	if (bytes > peakBytes)
+		peakBytes = bytes;
+}
+
+extern "C" long scripting_getMemory (scripting_MemoryEntry *entries, long max, long *peakObjectCount, double *peakByteCount) {
+	// Fill in entries with the number of objects of each type and their
+	// estimated size, and return how many types there are (at most max).
+	long numberOfTypes = 0;
+	sample_memory ();
+	for (int i = 1; i <= theCurrentPraatObjects -> n; i ++) {
+		Data object = theCurrentPraatObjects -> list [i]. object;
+		const wchar_t *type = Thing_className (object);
+		long k;
+		for (k = 0; k < numberOfTypes && wcscmp (entries [k]. type, type) != 0; k ++) { }
+		if (k == numberOfTypes) {
+			if (numberOfTypes == max)
+				continue;
+			entries [k]. type = type;
+			entries [k]. objects = 0;
+			entries [k]. bytes = 0;
+			numberOfTypes ++;
+		}
+		entries [k]. objects ++;
+		entries [k]. bytes += object_bytes (object);
+	}
+	*peakObjectCount = peakObjects;
+	*peakByteCount = peakBytes;
+	return numberOfTypes;
+}
+
+extern "C" const char *scripting_getArray (long id, const wchar_t *fullName, int view, scripting_Array *array) {
+	// Fill in array with the numbers inside the object with the given ID,
+	// or if id is 0 the object named fullName, or the selected object if
+	// fullName is NULL as well. Matrix-like objects (Sound, Spectrogram,
+	// ...) keep their cells in one block, so if view is set we point right
+	// into it; otherwise they are copied. Pitch and Formant frames are
+	// separate allocations, so their numbers are always copied. Returns an
+	// error message, or NULL on success.
+	int i = find_object (id, fullName);
+	if (i == 0)
+		return id || fullName ? "There is no such Praat object." : "Select exactly one Praat object.";
+
+	Data object = theCurrentPraatObjects -> list [i]. object;
+	memset (array, 0, sizeof (scripting_Array));
+	array -> id = theCurrentPraatObjects -> list [i]. id;
+
+	if (Thing_member (object, classMatrix)) {
+		Matrix me = (Matrix) object;
+		if (view) {
+			// Python can write to these numbers whenever it likes from now on.
+			scripting_queryCacheChanged (array -> id, 1);
+			array -> data = & my z [1] [1];
 		} else {
-			wchar_t *ret = (wchar_t*)malloc(sizeof(wchar_t));
-			*ret = 0;
-			return ret;
+			array -> data = (double*) malloc (my nx * my ny * sizeof (double));
+			if (! array -> data)
+				return "Out of memory.";
+			memcpy (array -> data, & my z [1] [1], my nx * my ny * sizeof (double));
+			array -> copied = 1;
 		}
+		array -> ndim = 2;
+		array -> rows = my ny;
+		array -> columns = my nx;
+		array -> columnstride = sizeof (double);
+		array -> rowstride = my nx * sizeof (double);
+	} else if (Thing_member (object, classPitch)) {
+		// The frequency of the best candidate in each frame, 0 if unvoiced.
+		Pitch me = (Pitch) object;
+		array -> data = (double*) malloc (my nx * sizeof (double));
+		if (! array -> data)
+			return "Out of memory.";
+		array -> copied = 1;
+		for (long iframe = 1; iframe <= my nx; iframe ++) {
+			Pitch_Frame frame = & my frame [iframe];
+			array -> data [iframe - 1] = frame -> nCandidates >= 1 ? frame -> candidate [1]. frequency : 0.0;
+		}
+		array -> ndim = 1;
+		array -> rows = my nx;
+		array -> columns = 1;
+		array -> rowstride = sizeof (double);
+		array -> columnstride = sizeof (double);
+	} else if (Thing_member (object, classFormant)) {
+		// One row per frame: F1, B1, F2, B2, ... with NaN for formants
+		// that the frame does not have.
+		Formant me = (Formant) object;
+		long ncol = 2 * my maxnFormants;
+		array -> data = (double*) malloc (my nx * ncol * sizeof (double));
+		if (! array -> data)
+			return "Out of memory.";
+		array -> copied = 1;
+		for (long iframe = 1; iframe <= my nx; iframe ++) {
+			Formant_Frame frame = & my frame [iframe];
+			double *row = array -> data + (iframe - 1) * ncol;
+			for (long iformant = 1; iformant <= my maxnFormants; iformant ++) {
+				if (iformant <= frame -> nFormants) {
+					row [2 * iformant - 2] = frame -> formant [iformant]. frequency;
+					row [2 * iformant - 1] = frame -> formant [iformant]. bandwidth;
+				} else {
+					row [2 * iformant - 2] = row [2 * iformant - 1] = NAN;
+				}
+			}
+		}
+		array -> ndim = 2;
+		array -> rows = my nx;
+		array -> columns = ncol;
+		array -> columnstride = sizeof (double);
+		array -> rowstride = ncol * sizeof (double);
 	} else {
-		return NULL;
+		return "Only Sound, Matrix, Spectrogram, Pitch and Formant objects (and their relatives) have numeric data that can be read this way.";
 	}
+
+	return NULL;
 }
 
-extern "C" int is_anything_selected() {
-	return praat_selection(NULL) != 0;
+extern "C" const char *scripting_getSoundInfo (long id, const wchar_t *fullName, scripting_SoundInfo *info) {
+	// Like scripting_getArray, for a LongSound or a Sound to be read in
+	// pieces with scripting_readSoundSamples.
+	int i = find_object (id, fullName);
+	if (i == 0)
+		return id || fullName ? "There is no such Praat object." : "Select exactly one Praat object.";
+
+	Data object = theCurrentPraatObjects -> list [i]. object;
+	if (Thing_member (object, classLongSound))
+		info -> numberOfChannels = ((LongSound) object) -> numberOfChannels;
+	else if (Thing_member (object, classSound))
+		info -> numberOfChannels = ((Sound) object) -> ny;
+	else
+		return "Only LongSound and Sound objects can be read in frames.";
+	Sampled me = (Sampled) object;
+	info -> id = theCurrentPraatObjects -> list [i]. id;
+	info -> numberOfSamples = my nx;
+	info -> startTime = my x1;
+	info -> samplingFrequency = 1.0 / my dx;
+	return NULL;
 }
 
-extern "C" wchar_t *get_name_of_selected() {
-	return praat_getNameOfSelected(NULL, 0);
+extern "C" const char *scripting_readSoundSamples (long id, long firstSample, long numberOfSamples, double *samples) {
+	// Copy numberOfSamples samples, starting from sample firstSample
+	// (counting from 1), of the LongSound or Sound with the given ID into
+	// samples, with the channels of each sample next to each other.
+	// Samples beyond the ends of the sound are 0. A LongSound is read
+	// through its own buffer, which holds one stretch of the file at a
+	// time, so that no more of the file than that is ever in memory.
+	// Returns an error message, or NULL on success.
+	int i = find_object (id, NULL);
+	if (i == 0)
+		return "The sound has been removed.";
+	Data object = theCurrentPraatObjects -> list [i]. object;
+	long nx = ((Sampled) object) -> nx;
+	long first = firstSample < 1 ? 1 : firstSample;
+	long last = firstSample + numberOfSamples - 1 > nx ? nx : firstSample + numberOfSamples - 1;
+
+	if (Thing_member (object, classLongSound)) {
+		LongSound me = (LongSound) object;
+		long channels = my numberOfChannels;
+		memset (samples, 0, numberOfSamples * channels * sizeof (double));
+		try {
+			for (long isample = first; isample <= last; ) {
+				// Ask for as much as the buffer holds.
+				long piece = last - isample + 1;
+				while (! LongSound_haveWindow (me, my x1 + (isample - 1.5) * my dx, my x1 + (isample + piece - 1.5) * my dx))
+					if ((piece /= 2) == 0)
+						return "The LongSound's buffer is too small.";
+				const short *from = my buffer + (isample - my imin) * channels;
+				double *to = samples + (isample - firstSample) * channels;
+				for (long k = 0; k < piece * channels; k ++)
+					to [k] = from [k] * (1.0 / 32768);
+				isample += piece;
+			}
+		} catch (MelderError) {
+			Melder_clearError ();
+			return "Cannot read from the LongSound's file.";
+		}
+	} else if (Thing_member (object, classSound)) {
+		Sound me = (Sound) object;
+		long channels = my ny;
+		memset (samples, 0, numberOfSamples * channels * sizeof (double));
+		for (long isample = first; isample <= last; isample ++)
+			for (long ichan = 1; ichan <= channels; ichan ++)
+				samples [(isample - firstSample) * channels + ichan - 1] = my z [ichan] [isample];
+	} else {
+		return "The sound has been removed.";
+	}
+	return NULL;
 }
 
-extern "C" void write_to_info_window(wchar_t *text) {
-	Melder_print (text);
+extern "C" wchar_t *scripting_createSound (const double *samples, long numberOfChannels, long numberOfSamples,
+	double startTime, double samplingFrequency, const wchar_t *name, int *haderror)
+{
+	// Add a new Sound to the object list with a copy of the samples, one row
+	// of numberOfSamples per channel, and select it. Errors are returned as
+	// in scripting_executePraatCommand.
+	try {
+		double dx = 1.0 / samplingFrequency;
+		autoSound me = Sound_create (numberOfChannels, startTime, startTime + numberOfSamples * dx,
+			numberOfSamples, dx, startTime + 0.5 * dx);
+		memcpy (& my z [1] [1], samples, numberOfChannels * numberOfSamples * sizeof (double));
+		praat_new1 (me.transfer(), name);
+		praat_updateSelection ();
+	} catch (MelderError) {
+	}
+	return finish_command (NULL, haderror);
+}
+
+extern "C" wchar_t *scripting_createMatrix (const double *cells, long numberOfRows, long numberOfColumns,
+	double x1, double dx, double y1, double dy, const wchar_t *name, int *haderror)
+{
+	// Likewise for a Matrix. Its domain extends half a cell beyond the
+	// first and last cell centres, as with "Create simple Matrix...".
+	try {
+		autoMatrix me = Matrix_create (x1 - 0.5 * dx, x1 + (numberOfColumns - 0.5) * dx, numberOfColumns, dx, x1,
+			y1 - 0.5 * dy, y1 + (numberOfRows - 0.5) * dy, numberOfRows, dy, y1);
+		memcpy (& my z [1] [1], cells, numberOfRows * numberOfColumns * sizeof (double));
+		praat_new1 (me.transfer(), name);
+		praat_updateSelection ();
+	} catch (MelderError) {
+	}
+	return finish_command (NULL, haderror);
+}
+
+static const wchar_t *arena_utf8ToWcs (const char *utf8) {
+	wchar_t *ret = transcode_arenaUtf8ToWcs (utf8, strlen (utf8));
+	if (! ret) Melder_throw ("Out of memory.");
+	return ret;
+}
+
+extern "C" wchar_t *scripting_createTable (const scripting_TableColumn *columns, long numberOfColumns, long numberOfRows,
+	const wchar_t *name, int *haderror)
+{
+	// Make a Table from the columns of a praat.ResultTable, cell by cell,
+	// and add it to the object list and select it. The text of a column is
+	// converted in the arena, which is emptied after each column.
+	size_t mark = arena_mark ();
+	try {
+		autoTable me = Table_createWithoutColumnNames (numberOfRows, numberOfColumns);
+		for (long icol = 1; icol <= numberOfColumns; icol ++) {
+			const scripting_TableColumn *column = & columns [icol - 1];
+			Table_setColumnLabel (me.peek(), icol, arena_utf8ToWcs (column->name));
+			for (long irow = 1; irow <= numberOfRows; irow ++) {
+				if (column->type == 'f') {
+					double x = ((const double *) column->data) [irow - 1];
+					Table_setNumericValue (me.peek(), irow, icol, isnan (x) ? NUMundefined : x);
+				} else if (column->type == 'i') {
+					Table_setNumericValue (me.peek(), irow, icol, (double) ((const long long *) column->data) [irow - 1]);
+				} else {
+					Table_setStringValue (me.peek(), irow, icol, arena_utf8ToWcs (((char * const *) column->data) [irow - 1]));
+				}
+			}
+			arena_release (mark);
+		}
+		praat_new1 (me.transfer(), name);
+		praat_updateSelection ();
+	} catch (MelderError) {
+		arena_release (mark);
+	}
+	return finish_command (NULL, haderror);
 }
 
 /* Interface from Praat (C++) into Python (C). */
@@ -135,15 +760,22 @@ int scripting_run_praat_script(Interpreter interpreter, wchar_t *script, wchar_t
 	if (wcsncmp(script, L"#lang=", 6) != 0)
 		return 0;
 
+	Interpreter outerInterpreter = current_interpreter;   // when run from inside another script
 	current_interpreter = interpreter;
 
+	int failed = 0;
 	if (wcsncmp(script, L"#lang=python", 12) == 0) {
-		scripting_run_python(script, argv);
+		failed = scripting_run_python(script, argv);
 	} else {
 		Melder_print (L"Unrecognized language in #lang= line in script. Use \"#lang=python\".\n");
 	}
 
-	current_interpreter = NULL;
+	current_interpreter = outerInterpreter;
+	// The traceback has been printed. In a praat-py --jobs worker, this
+	// makes the script fail in Praat too, so that the file is counted as
+	// failed; elsewhere a failed Python script doesn't stop Praat, as before.
+	if (failed && scripting_batchWorker)
+		Melder_throw ("The Python script failed.");
 	
 	return 1;
 }
@@ -1,9 +1,184 @@
-// This is included in Interpreter.cpp and scripting.cpp here.
-
-int scripting_run_praat_script(Interpreter interpreter, wchar_t *script, wchar_t **argv);
-extern "C" void scripting_run_python(wchar_t *script, wchar_t **argv);
-extern "C" void scripting_executePraatCommand2 (wchar_t *command);
-extern "C" wchar_t *scripting_executePraatCommand (wchar_t **commandargs, int divert, int *haderror);
-extern "C" int is_anything_selected();
-extern "C" wchar_t *get_name_of_selected();
-extern "C" void write_to_info_window(wchar_t *text);
+// This is included in Interpreter.cpp, melder_info.cpp, praat.cpp,
+// praat_actions.cpp, praat_menuCommands.cpp and in
+// the C++ files here, and in python.c, which sees only the C part.
+
+#ifndef SCRIPTING_H
+#define SCRIPTING_H
+
+#include <wchar.h>
+
+/* A Praat command that has been looked up once so that it can be
+ * called many times without parsing the command string and searching
+ * the menus again. index is positive for an action (a button in the
+ * dynamic menu), negative for a fixed menu command, and zero if the
+ * command has not been looked up yet. */
+typedef struct {
+	wchar_t *title;
+	long index;
+} scripting_PreparedCommand;
+
+/* A view of the numbers inside a Praat object, filled in by
+ * scripting_getArray. data points at rows x columns doubles, or just
+ * rows doubles if ndim is 1; the strides are in bytes. If copied is
+ * set, data was allocated for the caller, who must free it. Otherwise
+ * it points into the object with Praat ID id, and is only valid until
+ * the object is removed or a command replaces its numbers: nothing keeps
+ * them alive, so this is only done when the caller asks for a view. */
+typedef struct {
+	double *data;
+	int ndim;
+	long rows, columns;
+	long rowstride, columnstride;
+	int copied;
+	long id;
+} scripting_Array;
+
+/* The shape of a LongSound or Sound, filled in by scripting_getSoundInfo
+ * for reading it a frame at a time with scripting_readSoundSamples. */
+typedef struct {
+	long id;
+	long numberOfSamples;
+	int numberOfChannels;
+	double startTime, samplingFrequency;
+} scripting_SoundInfo;
+
+/* One analysis run on many objects at once by parallel.cpp, for
+ * praat.parallelMap: scripting_parallelBegin finds the objects,
+ * scripting_parallelRun runs the analyses on the thread pool and
+ * scripting_parallelEnd adds the new objects to the object list. */
+#define SCRIPTING_PARALLEL_MAX_ARGUMENTS 8
+typedef struct scripting_ParallelJob scripting_ParallelJob;
+
+/* Sound files read ahead on the same threads, for praat.prefetch: queue
+ * them with scripting_prefetchQueue and take their Sounds in the same order
+ * with scripting_prefetchNext. */
+typedef struct scripting_Prefetch scripting_Prefetch;
+
+/* A column of a praat.ResultTable, for scripting_createTable. type is
+ * 'f', 'i' or 's', and data points at the column's doubles, long longs or
+ * UTF-8 strings. */
+typedef struct {
+	const char *name;
+	int type;
+	const void *data;
+} scripting_TableColumn;
+
+/* The number of objects of one type and an estimate of the bytes they
+ * take, for praat.memory(). */
+typedef struct {
+	const wchar_t *type;
+	long objects;
+	double bytes;
+} scripting_MemoryEntry;
+
+/* What profile.c has gathered about one command title. The times are in
+ * seconds; phases splits them into putting the command line together,
+ * finding the command and running it. histogram [k] counts the calls that
+ * took less than 2^k microseconds (the last bucket counts the rest). */
+#define SCRIPTING_PROFILE_ARGUMENTS 0
+#define SCRIPTING_PROFILE_LOOKUP 1
+#define SCRIPTING_PROFILE_RUN 2
+#define SCRIPTING_PROFILE_PHASES 3
+#define SCRIPTING_PROFILE_BUCKETS 24
+typedef struct {
+	wchar_t *title;
+	long calls;
+	double total, max;
+	double phases [SCRIPTING_PROFILE_PHASES];
+	long outputBytes;
+	long histogram [SCRIPTING_PROFILE_BUCKETS];
+} scripting_ProfileEntry;
+
+#ifdef __cplusplus
+struct structInterpreter;
+int scripting_run_praat_script(struct structInterpreter *interpreter, wchar_t *script, wchar_t **argv);
+extern "C" {
+#endif
+
+int scripting_run_python(wchar_t *script, wchar_t **argv);
+void scripting_start_python();
+void scripting_reset_python();
+int scripting_runBatchJobs (wchar_t **argv, int *exitCode);
+extern int scripting_batchWorker;   // set in the worker processes of scripting_runBatchJobs
+int scripting_serve (wchar_t **argv, int *exitCode);
+double scripting_clock();
+void scripting_startupMark(const wchar_t *phase);
+void scripting_startupReport();
+int scripting_isHeadless(wchar_t **argv);
+long scripting_findAction (const wchar_t *title);
+long scripting_findMenuCommand (const wchar_t *title);
+void scripting_invalidateCommandIndex ();
+void scripting_executePraatCommand2 (wchar_t *command);
+wchar_t *scripting_executePraatCommand (wchar_t *command, long titleLength, int divert, int *haderror);
+wchar_t *scripting_executePreparedCommand (scripting_PreparedCommand *command, wchar_t *arguments, int divert, int *haderror);
+void scripting_reportReal (double value);
+int scripting_getTypedResult (double *value);
+const char *scripting_getArray (long id, const wchar_t *fullName, int view, scripting_Array *array);
+const char *scripting_getSoundInfo (long id, const wchar_t *fullName, scripting_SoundInfo *info);
+const char *scripting_readSoundSamples (long id, long firstSample, long numberOfSamples, double *samples);
+
+/* Objects are referred to by the unique ID that Praat gives each one.
+ * position is where in the object list the object was found last time;
+ * it is checked first and updated. */
+int scripting_findObject (long id, int *position);   // its position in the object list, or 0
+int scripting_objectExists (long id);
+long scripting_getSelectedObject (int *position);
+const wchar_t *scripting_getObjectName (long id, int *position);
+int scripting_selectObject (long id, int *position, int mode);
+int scripting_removeObject (long id, int *position);
+long scripting_selectObjects (long *ids, long n, int mode);
+long scripting_removeObjects (long *ids, long n);
+long scripting_lastObjectId ();
+long scripting_getSelectedIds (long *ids, long max);
+long scripting_removeObjectsAfter (long id, const long *keep, long numberKept);
+long scripting_getMemory (scripting_MemoryEntry *entries, long max, long *peakObjectCount, double *peakByteCount);
+wchar_t *scripting_createSound (const double *samples, long numberOfChannels, long numberOfSamples,
+	double startTime, double samplingFrequency, const wchar_t *name, int *haderror);
+wchar_t *scripting_createMatrix (const double *cells, long numberOfRows, long numberOfColumns,
+	double x1, double dx, double y1, double dy, const wchar_t *name, int *haderror);
+wchar_t *scripting_createTable (const scripting_TableColumn *columns, long numberOfColumns, long numberOfRows,
+	const wchar_t *name, int *haderror);
+scripting_ParallelJob *scripting_parallelBegin (const wchar_t *title, const long *ids, long numberOfObjects,
+	const double *arguments, long numberOfArguments, const char **error);
+void scripting_parallelRun (scripting_ParallelJob *job);
+wchar_t *scripting_parallelEnd (scripting_ParallelJob *job, long *newIds, int *haderror);
+scripting_Prefetch *scripting_prefetchCreate (long capacity);
+wchar_t *scripting_prefetchQueue (scripting_Prefetch *me, const wchar_t *path, int *haderror);
+wchar_t *scripting_prefetchNext (scripting_Prefetch *me, long *id, int *haderror);
+void scripting_prefetchDestroy (scripting_Prefetch *me);
+void write_to_info_window(wchar_t *text);
+void write_to_error_stream(wchar_t *text);
+
+/* Sending the Info window somewhere else (serve.cpp); see scripting.cpp. */
+void scripting_captureInfo (void (*sink) (int error, const wchar_t *text));
+int scripting_capturingInfo ();
+
+/* Profiling (profile.c). The calls do nothing unless scripting_profiling
+ * is set. */
+extern int scripting_profiling;
+void scripting_profileEnable(int on);
+void scripting_profileScriptBegin();
+void scripting_profileScriptEnd();
+void scripting_profileBegin();
+void scripting_profileTitle(const wchar_t *title, long length);
+void scripting_profilePhase(int phase);
+void scripting_profileOutput(long bytes);
+void scripting_profileEnd();
+long scripting_profileCount();
+const scripting_ProfileEntry *scripting_profileEntry(long i);
+double scripting_profileElapsed();
+
+/* Following changes to objects for the query cache (querycache.c). The calls
+ * do nothing unless scripting_queryCaching is set. A command run by title
+ * may change the selected objects unless it is a pure query; anything else
+ * that may change an object reports it with scripting_queryCacheChanged. */
+extern int scripting_queryCaching;
+int scripting_isPureQuery(const wchar_t *title, long length);
+void scripting_queryCacheCommand(const wchar_t *title);
+void scripting_queryCacheChanged(long id, int forever);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,488 @@
+// This file lets other programs use Praat-Py without an X display and get
+// back what they asked for, which sendpraat can't do:
+//
+//     praat-py --serve SOCKET
+//
+// starts Praat and Python once and then listens on the Unix domain socket
+// SOCKET. Clients (such as praat-py-send, praatpy_send.c) send scripts and
+// commands, which are run one at a time in the order in which they arrive,
+// and get back the Info window output, the results and the errors of each.
+//
+// Every message is a frame: the length of the payload as four bytes, most
+// significant first, one byte for the type of the frame, and the payload.
+// Text is UTF-8. A client sends
+//
+//     'A'  an argument for the next script, argv [0] first (optional)
+//     'W'  the directory to run the next request in (optional)
+//     'P'  a Python script, 'S' a Praat script, or 'C' one command line,
+//          each of which is a request
+//
+// and gets back, for each request in turn,
+//
+//     'O'  a piece of Info window output, as the request produces it
+//     'E'  an error message (or what a Python script wrote to sys.stderr)
+//     'N'  the number a query command ('C') reported, as text
+//     'B'  an object the request created and left behind: "ID<tab>name"
+//     'D'  the end of the request: "0" if it succeeded, "1" if it failed
+//
+// A client may send several requests before reading the replies. The
+// objects and imported modules that a request leaves behind are there for
+// the next one, whichever client sends it.
+
+#include <stdio.h>
+#include <wchar.h>
+
+#include "../sys/melder.h"
+#include "../sys/praatP.h"
+#include "../sys/praat_script.h"
+#include "../sys/Interpreter.h"
+
+#include "util.h"
+#include "transcode.h"
+#include "scripting.h"
+
+#if defined (_WIN32)
+
+extern "C" int scripting_serve (wchar_t **argv, int *exitCode) {
+	if (argv == NULL || argv [0] == NULL || wcscmp (argv [0], L"--serve") != 0)
+		return 0;
+	fprintf (stderr, "praat-py: --serve is not available on Windows.\n");
+	*exitCode = 1;
+	return 1;
+}
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS 64
+#define MAX_FRAME_SIZE (256L << 20)
+#define SEND_TIMEOUT 60   // seconds; a client that stops reading its replies is dropped
+
+typedef struct {
+	int fd;   // -1 for a free slot
+	long serial;   // tells a client from a later one in the same slot
+	char *buffer;   // what has been received but not yet handled
+	size_t length, capacity;
+	wchar_t **argv;   // the 'A' frames so far, NULL-terminated
+	long argc;
+	wchar_t *directory;
+} Client;
+
+typedef struct Request {
+	int iclient;
+	long serial;
+	int type;
+	wchar_t *text, **argv, *directory;
+	struct Request *next;
+} Request;
+
+static Client clients [MAX_CLIENTS];
+static long lastSerial = 0;
+static Request *firstRequest = NULL, *lastRequest = NULL;
+static int currentClient = -1;   // the client whose request is running, if it is still there
+static volatile sig_atomic_t stopping = 0;
+
+static void stop (int sig) {
+	(void) sig;
+	stopping = 1;
+}
+
+static void free_argv (wchar_t **argv) {
+	if (argv == NULL)
+		return;
+	for (wchar_t **arg = argv; *arg; arg ++)
+		free (*arg);
+	free (argv);
+}
+
+static void free_request (Request *request) {
+	free (request -> text);
+	free_argv (request -> argv);
+	free (request -> directory);
+	free (request);
+}
+
+static void drop_client (int iclient) {
+	// The client's requests that are still queued are skipped when their
+	// turn comes, because the slot's serial or fd no longer matches.
+	Client *client = & clients [iclient];
+	close (client -> fd);
+	client -> fd = -1;
+	free (client -> buffer);
+	free_argv (client -> argv);
+	free (client -> directory);
+	client -> buffer = NULL;
+	client -> length = client -> capacity = 0;
+	client -> argv = NULL;
+	client -> argc = 0;
+	client -> directory = NULL;
+}
+
+static int write_all (int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t n = write (fd, data, length);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		data += n;
+		length -= n;
+	}
+	return 1;
+}
+
+static void send_frame (int type, const char *payload, size_t length) {
+	if (currentClient == -1)
+		return;
+	unsigned char header [5] = { (unsigned char) (length >> 24), (unsigned char) (length >> 16),
+		(unsigned char) (length >> 8), (unsigned char) length, (unsigned char) type };
+	int fd = clients [currentClient]. fd;
+	if (! write_all (fd, (const char *) header, sizeof header) || ! write_all (fd, payload, length)) {
+		drop_client (currentClient);
+		currentClient = -1;
+	}
+}
+
+static void send_text (int type, const wchar_t *text) {
+	size_t length = wcslen (text), mark = arena_mark ();
+	char *utf8 = (char *) arena_alloc (transcode_utf8Length (text, length) + 1);
+	if (utf8)
+		send_frame (type, utf8, transcode_toUtf8 (utf8, text, length));
+	arena_release (mark);
+}
+
+static void info_sink (int error, const wchar_t *text) {
+	// See scripting_captureInfo.
+	send_text (error ? 'E' : 'O', text);
+}
+
+static void send_created_objects (long lastId) {
+	for (int i = 1; i <= theCurrentPraatObjects -> n; i ++) {
+		if (theCurrentPraatObjects -> list [i]. id <= lastId)
+			continue;
+		char line [1000];
+		snprintf (line, sizeof line, "%ld\t%s", theCurrentPraatObjects -> list [i]. id,
+			Melder_peekWcsToUtf8 (theCurrentPraatObjects -> list [i]. name));
+		send_frame ('B', line, strlen (line));
+	}
+}
+
+static long title_length (const wchar_t *command) {
+	// For the profile: a command's title ends with "..." if it has arguments.
+	const wchar_t *dots = wcsstr (command, L"...");
+	return dots ? dots - command + 3 : -1;
+}
+
+static void run_request (Request *request) {
+	Client *client = & clients [request -> iclient];
+	if (client -> fd == -1 || client -> serial != request -> serial)
+		return;   // nobody to run it for
+	currentClient = request -> iclient;
+
+	char savedDirectory [4096];
+	int moved = 0;
+	if (request -> directory) {
+		if (getcwd (savedDirectory, sizeof savedDirectory) == NULL ||
+			chdir (Melder_peekWcsToUtf8 (request -> directory)) == -1)
+		{
+			send_text ('E', L"The server cannot change to the client's directory.");
+			send_frame ('D', "1", 1);
+			currentClient = -1;
+			return;
+		}
+		moved = 1;
+	}
+
+	long lastId = scripting_lastObjectId ();
+	int failed = 0;
+	size_t mark = arena_mark ();
+	scripting_captureInfo (info_sink);
+	if (request -> type == 'C') {
+		int haderror;
+		double number;
+		wchar_t *result = scripting_executePraatCommand (request -> text, title_length (request -> text), 1, & haderror);
+		if (haderror) {
+			send_text ('E', result);
+			failed = 1;
+		} else {
+			if (result && *result)
+				send_text ('O', result);
+			if (scripting_getTypedResult (& number)) {
+				char text [40];
+				snprintf (text, sizeof text, "%.17g", number);
+				send_frame ('N', text, strlen (text));
+			}
+		}
+	} else if (request -> type == 'P') {
+		failed = scripting_run_python (request -> text, request -> argv) != 0;
+	} else {
+		try {
+			autoInterpreter interpreter = Interpreter_create (NULL, NULL);
+			Interpreter_setArgv (interpreter.peek(), (const wchar **) request -> argv);
+			Interpreter_run (interpreter.peek(), request -> text); therror
+		} catch (MelderError) {
+			scripting_captureInfo (info_sink);   // sends the output that came before the error
+			send_text ('E', Melder_getError ());
+			Melder_clearError ();
+			failed = 1;
+		}
+	}
+	scripting_captureInfo (NULL);
+	arena_release (mark);
+	send_created_objects (lastId);
+
+	if (moved && chdir (savedDirectory) == -1)
+		fprintf (stderr, "praat-py: cannot change back to %s\n", savedDirectory);
+	send_frame ('D', failed ? "1" : "0", 1);
+	currentClient = -1;
+}
+
+static wchar_t *frame_text (const char *payload, size_t length) {
+	return transcode_utf8ToWcs (payload, length);
+}
+
+static int handle_frame (int iclient, int type, const char *payload, size_t length) {
+	// Returns 0 if the client has broken the protocol, or if there is no
+	// memory for the frame.
+	Client *client = & clients [iclient];
+	if (type == 'A') {
+		wchar_t **argv = (wchar_t **) realloc (client -> argv, (client -> argc + 2) * sizeof (wchar_t *));
+		if (! argv)
+			return 0;   // client -> argv is still there, and still ends in NULL
+		client -> argv = argv;
+		if (! (client -> argv [client -> argc] = frame_text (payload, length)))
+			return 0;
+		client -> argv [++ client -> argc] = NULL;
+	} else if (type == 'W') {
+		free (client -> directory);
+		if (! (client -> directory = frame_text (payload, length)))
+			return 0;
+	} else if (type == 'P' || type == 'S' || type == 'C') {
+		Request *request = (Request *) calloc (1, sizeof (Request));
+		if (! request)
+			return 0;
+		request -> iclient = iclient;
+		request -> serial = client -> serial;
+		request -> type = type;
+		request -> text = frame_text (payload, length);
+		if (client -> argv == NULL) {
+			client -> argv = (wchar_t **) calloc (2, sizeof (wchar_t *));
+			if (client -> argv && ! (client -> argv [0] = wcsdup (L""))) {
+				free (client -> argv);
+				client -> argv = NULL;
+			}
+		}
+		if (! request -> text || ! client -> argv) {
+			free (request -> text);
+			free (request);
+			return 0;
+		}
+		request -> argv = client -> argv;
+		request -> directory = client -> directory;
+		client -> argv = NULL;
+		client -> argc = 0;
+		client -> directory = NULL;
+		if (lastRequest)
+			lastRequest -> next = request;
+		else
+			firstRequest = request;
+		lastRequest = request;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void read_client (int iclient) {
+	Client *client = & clients [iclient];
+	if (client -> capacity - client -> length < 65536) {
+		size_t capacity = client -> capacity ? 2 * client -> capacity : 131072;
+		char *buffer = (char *) realloc (client -> buffer, capacity);
+		if (! buffer) {
+			drop_client (iclient);
+			return;
+		}
+		client -> buffer = buffer;
+		client -> capacity = capacity;
+	}
+	ssize_t n = read (client -> fd, client -> buffer + client -> length, client -> capacity - client -> length);
+	if (n == -1 && errno == EINTR)
+		return;
+	if (n <= 0) {
+		drop_client (iclient);
+		return;
+	}
+	client -> length += n;
+
+	size_t done = 0;
+	while (client -> length - done >= 5) {
+		const unsigned char *header = (const unsigned char *) client -> buffer + done;
+		size_t length = (size_t) header [0] << 24 | (size_t) header [1] << 16 | (size_t) header [2] << 8 | header [3];
+		if (length > (size_t) MAX_FRAME_SIZE) {
+			drop_client (iclient);
+			return;
+		}
+		if (client -> length - done < 5 + length)
+			break;
+		if (! handle_frame (iclient, header [4], client -> buffer + done + 5, length)) {
+			drop_client (iclient);
+			return;
+		}
+		done += 5 + length;
+	}
+	memmove (client -> buffer, client -> buffer + done, client -> length - done);
+	client -> length -= done;
+}
+
+static void accept_client (int listener) {
+	int fd = accept (listener, NULL, NULL);
+	if (fd == -1)
+		return;
+	int iclient = 0;
+	while (iclient < MAX_CLIENTS && clients [iclient]. fd != -1)
+		iclient ++;
+	if (iclient == MAX_CLIENTS) {
+		close (fd);
+		return;
+	}
+	struct timeval timeout = { SEND_TIMEOUT, 0 };
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, & timeout, sizeof timeout);
+	clients [iclient]. fd = fd;
+	clients [iclient]. serial = ++ lastSerial;
+}
+
+static int claim_path (const char *path, struct sockaddr_un *address) {
+	// A socket left behind by a server that has gone is removed; anything
+	// else at path (a live server, or a file that isn't a socket) is left
+	// alone, and 0 is returned.
+	struct stat st;
+	if (lstat (path, & st) == -1)
+		return 1;
+	if (! S_ISSOCK (st.st_mode))
+		return 0;
+	int probe = socket (AF_UNIX, SOCK_STREAM, 0);
+	int live = probe != -1 && connect (probe, (struct sockaddr *) address, sizeof *address) == 0;
+	if (probe != -1)
+		close (probe);
+	if (live)
+		return 0;
+	unlink (path);
+	return 1;
+}
+
+extern "C" int scripting_serve (wchar_t **argv, int *exitCode) {
+	// argv is the command line starting from "--serve". Returns 0 if this
+	// is not a --serve command line. Otherwise serves until SIGINT or
+	// SIGTERM, and returns 1.
+	if (argv == NULL || argv [0] == NULL || wcscmp (argv [0], L"--serve") != 0)
+		return 0;
+
+	*exitCode = 1;
+	if (argv [1] == NULL) {
+		fprintf (stderr, "praat-py: usage: praat-py --serve SOCKET\n");
+		return 1;
+	}
+	char path [sizeof ((struct sockaddr_un *) 0) -> sun_path];
+	const char *utf8 = Melder_peekWcsToUtf8 (argv [1]);
+	if (strlen (utf8) >= sizeof path) {
+		fprintf (stderr, "praat-py: the socket name %s is too long.\n", utf8);
+		return 1;
+	}
+	strcpy (path, utf8);
+
+	struct sockaddr_un address;
+	memset (& address, 0, sizeof address);
+	address.sun_family = AF_UNIX;
+	strcpy (address.sun_path, path);
+	if (! claim_path (path, & address)) {
+		fprintf (stderr, "praat-py: %s is in use.\n", path);
+		return 1;
+	}
+	int listener = socket (AF_UNIX, SOCK_STREAM, 0);
+	// Whoever can connect can run any code as us, so the socket is ours only.
+	mode_t mask = umask (077);
+	int bound = listener != -1 && bind (listener, (struct sockaddr *) & address, sizeof address) == 0;
+	umask (mask);
+	if (! bound || listen (listener, 16) == -1) {
+		perror ("praat-py: cannot listen on the socket");
+		if (listener != -1)
+			close (listener);
+		return 1;
+	}
+
+	struct sigaction action;
+	memset (& action, 0, sizeof action);
+	action.sa_handler = stop;   // no SA_RESTART, so that poll returns
+	sigaction (SIGINT, & action, NULL);
+	sigaction (SIGTERM, & action, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	for (int iclient = 0; iclient < MAX_CLIENTS; iclient ++)
+		clients [iclient]. fd = -1;
+	scripting_start_python ();
+	fprintf (stderr, "praat-py: serving on %s\n", path);
+
+	while (! stopping) {
+		struct pollfd fds [1 + MAX_CLIENTS];
+		int which [1 + MAX_CLIENTS], n = 0;
+		fds [n]. fd = listener;
+		fds [n]. events = POLLIN;
+		which [n ++] = -1;
+		for (int iclient = 0; iclient < MAX_CLIENTS; iclient ++) {
+			if (clients [iclient]. fd == -1)
+				continue;
+			fds [n]. fd = clients [iclient]. fd;
+			fds [n]. events = POLLIN;
+			which [n ++] = iclient;
+		}
+
+		// Take in whatever the clients have sent, then run one request, so
+		// that the queue is in the order the requests arrived.
+		if (poll (fds, n, firstRequest ? 0 : -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror ("praat-py: poll");
+			break;
+		}
+		for (int i = 1; i < n; i ++)
+			if (fds [i]. revents & (POLLIN | POLLHUP | POLLERR))
+				read_client (which [i]);
+		if (fds [0]. revents & POLLIN)
+			accept_client (listener);
+
+		if (firstRequest) {
+			Request *request = firstRequest;
+			firstRequest = request -> next;
+			if (firstRequest == NULL)
+				lastRequest = NULL;
+			run_request (request);
+			free_request (request);
+		}
+	}
+
+	while (firstRequest) {
+		Request *request = firstRequest;
+		firstRequest = request -> next;
+		free_request (request);
+	}
+	for (int iclient = 0; iclient < MAX_CLIENTS; iclient ++)
+		if (clients [iclient]. fd != -1)
+			drop_client (iclient);
+	close (listener);
+	unlink (path);
+	*exitCode = 0;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,107 @@
+// This file times Praat's start-up and decides whether a batch run
+// can skip the parts of it that only matter to an interactive Praat.
+//
+// praat.cpp calls scripting_startupMark at the end of each phase of the
+// start-up. If the environment variable PRAATPY_STARTUP_TIMES is set, the
+// time spent in each phase is written to stderr just before the first
+// Python script starts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if defined (_WIN32)
+	#include <windows.h>
+#else
+	#include <time.h>
+	#include <sys/time.h>
+#endif
+
+#include "util.h"
+#include "scripting.h"
+
+#define MAX_STARTUP_MARKS 16
+
+static struct {
+	const wchar_t *phase;
+	double time;
+} marks [MAX_STARTUP_MARKS];
+static int numberOfMarks = 0;
+static int reported = 0;
+
+double scripting_clock() {
+	// Seconds on a clock that doesn't jump. Also used by profile.c.
+	#if defined (_WIN32)
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (double)counter.QuadPart / (double)frequency.QuadPart;
+	#elif defined (CLOCK_MONOTONIC)
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec * 1e-9;
+	#else
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec * 1e-6;
+	#endif
+}
+
+void scripting_startupMark(const wchar_t *phase) {
+	// Record the end of a start-up phase. The first mark only starts the
+	// clock, so its name is not reported.
+	if (numberOfMarks == MAX_STARTUP_MARKS || reported)
+		return;
+	marks[numberOfMarks].phase = phase;
+	marks[numberOfMarks].time = scripting_clock();
+	numberOfMarks++;
+}
+
+void scripting_startupReport() {
+	int i;
+	if (reported)
+		return;
+	reported = 1;
+	if (!getenv("PRAATPY_STARTUP_TIMES") || numberOfMarks < 2)
+		return;
+	fprintf(stderr, "praat-py: start-up took %.1f ms%s:\n",
+		(marks[numberOfMarks - 1].time - marks[0].time) * 1000.0,
+		scripting_isHeadless(NULL) ? " (headless)" : "");
+	for (i = 1; i < numberOfMarks; i++)
+		fprintf(stderr, "   %8.1f ms  %ls\n", (marks[i].time - marks[i - 1].time) * 1000.0, marks[i].phase);
+}
+
+static int first_line_is_python(wchar_t *path) {
+	char *cpath = wc2c(path, 0);
+	char line [32] = "";
+	FILE *f = fopen(cpath, "r");
+	free(cpath);
+	if (!f)
+		return 0;
+	if (!fgets(line, sizeof line, f))
+		line[0] = 0;
+	fclose(f);
+	return strncmp(line, "#lang=python", 12) == 0;
+}
+
+int scripting_isHeadless(wchar_t **argv) {
+	// A batch run of a #lang=python script (or a --jobs run of one) is
+	// headless, and so is a --serve server: it doesn't read the user's
+	// buttons file or plugins or write the preferences back when it's
+	// done. Set PRAATPY_HEADLESS to 0 to start up in full anyway. argv is
+	// the command line as kept by praat.cpp, or NULL for a non-batch Praat;
+	// the answer is worked out the first time and remembered.
+	static int headless = -1;
+	if (headless == -1) {
+		const char *env = getenv("PRAATPY_HEADLESS");
+		wchar_t *script = NULL;
+		if (argv == NULL)
+			return 0;
+		if (argv[0])
+			script = wcscmp(argv[0], L"--jobs") == 0 ? (argv[1] ? argv[2] : NULL) : argv[0];
+		headless = !(env && strcmp(env, "0") == 0) &&
+			((argv[0] && wcscmp(argv[0], L"--serve") == 0) || (script != NULL && first_line_is_python(script)));
+	}
+	return headless;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Checks that praat-py --jobs reports which jobs failed: a script that
+# raises or calls sys.exit(1) fails, sys.exit(0) succeeds, and neither
+# stops the worker from taking the rest of the queue.
+#
+#     sh test/jobs.sh ../praat
+
+PRAAT=${1:-../praat}
+DIR=`dirname "$0"`
+OUT=`mktemp`
+ERR=`mktemp`
+trap 'rm -f "$OUT" "$ERR"' EXIT
+
+"$PRAAT" --jobs 2 "$DIR/job.praatpy" -- one raise exit0 exit1 exit0 exit0 two >"$OUT" 2>"$ERR"
+status=$?
+failed=0
+
+check () {
+	if ! grep -q "$2" "$1"; then
+		echo "jobs.sh: expected \"$2\" in the $3" >&2
+		failed=1
+	fi
+}
+
+[ $status -eq 1 ] || { echo "jobs.sh: exit status $status, expected 1" >&2; failed=1; }
+check "$OUT" "^done one" output
+check "$OUT" "^done two" output
+check "$ERR" "ValueError: this job fails" errors
+check "$ERR" "2 of 7 files failed" errors
+check "$ERR" "raise (script error)" errors
+check "$ERR" "exit1 (script error)" errors
+if grep -q "exit0 (\|not run" "$ERR"; then
+	echo "jobs.sh: sys.exit(0) was counted as a failure" >&2
+	failed=1
+fi
+[ $failed -eq 0 ] && echo "jobs.sh: ok"
+exit $failed
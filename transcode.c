@@ -0,0 +1,278 @@
+// This file converts text between UTF-8 and wchar_t (see transcode.h).
+//
+// Most of the text that crosses between Python and Praat is ASCII: command
+// titles, numbers, object names, the output of print. So both directions
+// look for runs of ASCII characters a block at a time, with SSE2 where the
+// compiler has it (on x86-64 it always does), and copy them over in one
+// go. Everything else goes one character at a time. wchar_t is UTF-32 on
+// Unix and UTF-16 on Windows.
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "util.h"
+#include "transcode.h"
+
+#if WCHAR_MAX > 0xFFFF
+	#define WIDE_UTF32 1
+	#if defined (__SSE2__)
+		#define WIDE_SSE2 1
+		#include <emmintrin.h>
+	#endif
+#endif
+
+#define REPLACEMENT 0xFFFD
+
+/* ASCII runs. */
+
+static size_t ascii_bytes(const unsigned char *s, size_t length) {
+	// The number of ASCII bytes at the start of s.
+	size_t n = 0;
+#if defined (WIDE_SSE2)
+	while (n + 16 <= length && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + n))) == 0)
+		n += 16;
+#else
+	while (n + 8 <= length) {
+		unsigned long long word;
+		memcpy(&word, s + n, 8);
+		if (word & 0x8080808080808080ULL)
+			break;
+		n += 8;
+	}
+#endif
+	while (n < length && s[n] < 0x80)
+		n++;
+	return n;
+}
+
+static size_t ascii_wide(const wchar_t *wc, size_t length) {
+	// The number of wide characters below 0x80 at the start of wc.
+	size_t n = 0;
+#if defined (WIDE_SSE2)
+	const __m128i high = _mm_set1_epi32(~0x7F), zero = _mm_setzero_si128();
+	while (n + 8 <= length) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(wc + n));
+		__m128i b = _mm_loadu_si128((const __m128i*)(wc + n + 4));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(a, b), high), zero)) != 0xFFFF)
+			break;
+		n += 8;
+	}
+#endif
+	while (n < length && (unsigned long)wc[n] < 0x80)
+		n++;
+	return n;
+}
+
+static void widen_ascii(wchar_t *out, const unsigned char *s, size_t n) {
+	size_t i = 0;
+#if defined (WIDE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i*)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = s[i];
+}
+
+static void narrow_ascii(char *out, const wchar_t *wc, size_t n) {
+	size_t i = 0;
+#if defined (WIDE_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(wc + i)), _mm_loadu_si128((const __m128i*)(wc + i + 4)));
+		__m128i b = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(wc + i + 8)), _mm_loadu_si128((const __m128i*)(wc + i + 12)));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = (char)wc[i];
+}
+
+/* One character at a time. */
+
+static inline unsigned long next_wide(const wchar_t *wc, size_t length, size_t *i) {
+	// The code point at wc[*i], which is advanced past it.
+	unsigned long c = (unsigned long)wc[(*i)++];
+#if !defined (WIDE_UTF32)
+	c &= 0xFFFF;
+	if (c >= 0xD800 && c < 0xDC00 && *i < length && wc[*i] >= 0xDC00 && wc[*i] < 0xE000)
+		return 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)wc[(*i)++] - 0xDC00);
+#else
+	(void)length;   // only needed for pairing UTF-16 surrogates
+#endif
+	if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+		return REPLACEMENT;
+	return c;
+}
+
+static inline unsigned long next_utf8(const unsigned char *s, size_t length, size_t *i) {
+	// The code point of the UTF-8 sequence at s[*i], which is advanced past
+	// it. As in Python and the Unicode standard, each longest start of a
+	// sequence that could still have been valid is one U+FFFD.
+	const unsigned char *q = s + *i;
+	unsigned long c = q[0];
+	unsigned char low = 0x80, high = 0xBF;   // the range of the second byte
+	int k, n;
+	// Well-formed two- and three-byte sequences, which is nearly all text
+	// that isn't ASCII, take the short way.
+	if (c >= 0xC2 && c <= 0xDF && *i + 1 < length && (q[1] & 0xC0) == 0x80) {
+		*i += 2;
+		return (c & 0x1F) << 6 | (q[1] & 0x3F);
+	}
+	if (c >= 0xE0 && c <= 0xEF && *i + 2 < length && (q[1] & 0xC0) == 0x80 && (q[2] & 0xC0) == 0x80) {
+		unsigned long d = (c & 0x0F) << 12 | (q[1] & 0x3F) << 6 | (q[2] & 0x3F);
+		if (d >= 0x800 && (d < 0xD800 || d >= 0xE000)) {
+			*i += 3;
+			return d;
+		}
+	}
+	if (c < 0x80) {
+		(*i)++;
+		return c;
+	} else if (c >= 0xC2 && c <= 0xDF) {
+		n = 1; c &= 0x1F;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		n = 2; c &= 0x0F;
+		if (c == 0x0) low = 0xA0;   // not overlong
+		if (c == 0xD) high = 0x9F;   // not a surrogate
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		n = 3; c &= 0x07;
+		if (c == 0) low = 0x90;   // not overlong
+		if (c == 4) high = 0x8F;   // not above U+10FFFF
+	} else {
+		(*i)++;
+		return REPLACEMENT;
+	}
+	for (k = 1; k <= n; k++) {
+		if (*i + k >= length || q[k] < low || q[k] > high) {
+			*i += k;
+			return REPLACEMENT;
+		}
+		c = c << 6 | (q[k] & 0x3F);
+		low = 0x80, high = 0xBF;
+	}
+	*i += n + 1;
+	return c;
+}
+
+/* Both directions. */
+
+size_t transcode_utf8Length(const wchar_t *wc, size_t length) {
+	size_t i = 0, bytes = 0;
+	while (i < length) {
+		if ((unsigned long)wc[i] < 0x80) {
+			size_t n = ascii_wide(wc + i, length - i);
+			i += n;
+			bytes += n;
+		} else {
+			unsigned long c = next_wide(wc, length, &i);
+			bytes += c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+		}
+	}
+	return bytes;
+}
+
+size_t transcode_toUtf8(char *out, const wchar_t *wc, size_t length) {
+	size_t i = 0;
+	char *p = out;
+	while (i < length) {
+		if ((unsigned long)wc[i] < 0x80) {
+			size_t n = ascii_wide(wc + i, length - i);
+			narrow_ascii(p, wc + i, n);
+			i += n;
+			p += n;
+		} else {
+			unsigned long c = next_wide(wc, length, &i);
+			if (c < 0x800) {
+				*p++ = (char)(0xC0 | c >> 6);
+			} else if (c < 0x10000) {
+				*p++ = (char)(0xE0 | c >> 12);
+				*p++ = (char)(0x80 | (c >> 6 & 0x3F));
+			} else {
+				*p++ = (char)(0xF0 | c >> 18);
+				*p++ = (char)(0x80 | (c >> 12 & 0x3F));
+				*p++ = (char)(0x80 | (c >> 6 & 0x3F));
+			}
+			*p++ = (char)(0x80 | (c & 0x3F));
+		}
+	}
+	*p = 0;
+	return p - out;
+}
+
+size_t transcode_wcsLength(const char *utf8, size_t length) {
+	const unsigned char *s = (const unsigned char*)utf8;
+	size_t i = 0, chars = 0;
+	while (i < length) {
+		if (s[i] < 0x80) {
+			size_t n = ascii_bytes(s + i, length - i);
+			i += n;
+			chars += n;
+		} else {
+#if defined (WIDE_UTF32)
+			next_utf8(s, length, &i);
+			chars++;
+#else
+			chars += next_utf8(s, length, &i) > 0xFFFF ? 2 : 1;
+#endif
+		}
+	}
+	return chars;
+}
+
+size_t transcode_fromUtf8(wchar_t *out, const char *utf8, size_t length) {
+	const unsigned char *s = (const unsigned char*)utf8;
+	size_t i = 0;
+	wchar_t *p = out;
+	while (i < length) {
+		if (s[i] < 0x80 && (i + 1 == length || s[i + 1] >= 0x80)) {
+			*p++ = s[i++];   // a space between words, say
+		} else if (s[i] < 0x80) {
+			size_t n = ascii_bytes(s + i, length - i);
+			widen_ascii(p, s + i, n);
+			i += n;
+			p += n;
+		} else {
+			unsigned long c = next_utf8(s, length, &i);
+#if !defined (WIDE_UTF32)
+			if (c > 0xFFFF) {
+				*p++ = (wchar_t)(0xD800 + ((c - 0x10000) >> 10));
+				c = 0xDC00 + ((c - 0x10000) & 0x3FF);
+			}
+#endif
+			*p++ = (wchar_t)c;
+		}
+	}
+	*p = 0;
+	return p - out;
+}
+
+char *transcode_wcsToUtf8(const wchar_t *wc) {
+	size_t length = wcslen(wc);
+	char *ret = (char*)malloc(transcode_utf8Length(wc, length) + 1);
+	if (ret)
+		transcode_toUtf8(ret, wc, length);
+	return ret;
+}
+
+wchar_t *transcode_utf8ToWcs(const char *utf8, size_t length) {
+	wchar_t *ret = (wchar_t*)malloc((transcode_wcsLength(utf8, length) + 1) * sizeof(wchar_t));
+	if (ret)
+		transcode_fromUtf8(ret, utf8, length);
+	return ret;
+}
+
+wchar_t *transcode_arenaUtf8ToWcs(const char *utf8, size_t length) {
+	// Scratch memory is cheap, so this takes one wide character per byte
+	// rather than going over the text twice.
+	wchar_t *ret = (wchar_t*)arena_alloc((length + 1) * sizeof(wchar_t));
+	if (ret)
+		transcode_fromUtf8(ret, utf8, length);
+	return ret;
+}
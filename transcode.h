@@ -0,0 +1,35 @@
+// Converting text between UTF-8 and wchar_t (transcode.c). Python's byte
+// strings, the output of print and the script text are UTF-8, and Praat's
+// strings are wchar_t. These conversions don't depend on the locale, which
+// for a command-line run is often "C", and they don't fail: malformed UTF-8
+// and unpaired surrogates come out as U+FFFD.
+
+#include <wchar.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The number of bytes (or wide characters) that the first length wide
+ * characters (or bytes) take once converted, without a terminating null. */
+size_t transcode_utf8Length(const wchar_t *wc, size_t length);
+size_t transcode_wcsLength(const char *utf8, size_t length);
+
+/* Convert length characters into out, which must have room for the number
+ * of bytes (or wide characters) given above plus a terminating null, which
+ * is written. Returns the length of the result. Converting to wchar_t, one
+ * wide character per byte is always enough. */
+size_t transcode_toUtf8(char *out, const wchar_t *wc, size_t length);
+size_t transcode_fromUtf8(wchar_t *out, const char *utf8, size_t length);
+
+/* The same, into a newly allocated string of exactly the right size, or
+ * into the arena (see util.h) with one wide character per byte. NULL if
+ * there is no memory. */
+char *transcode_wcsToUtf8(const wchar_t *wc);
+wchar_t *transcode_utf8ToWcs(const char *utf8, size_t length);
+wchar_t *transcode_arenaUtf8ToWcs(const char *utf8, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,20 +4,105 @@
 #include <string.h>
 #include <wchar.h>
 #include "util.h"
+#include "transcode.h"
 
 
 char *wc2c(wchar_t *wc, int doFree) {
-	const wchar_t *wc2 = wc;
-	size_t clen = wcslen(wc) * 4;
-	if (clen < 32) clen = 32;
-	char *cret = (char*)malloc(clen);
-	if (wcsrtombs (cret, &wc2, clen, NULL) == -1) {
-		strcpy(cret, "[wide character conversion failed]");
-	}
+	char *cret = transcode_wcsToUtf8(wc);
 	if (doFree) free(wc);
 	return cret;
 }
 
+/* The arena (see util.h) is a list of blocks, the newest first. A mark is
+ * the number of bytes in use across all of them. When the arena is emptied
+ * after it had to add blocks, they are replaced by a single block as big as
+ * all of them together, so that a script's commands soon all fit in one. */
+
+typedef struct ArenaBlock {
+	struct ArenaBlock *previous;
+	size_t start;   // the mark at the beginning of this block
+	size_t size, used;
+	double data [1];   // aligned for anything the arena is asked for
+} ArenaBlock;
+
+static ArenaBlock *arena = NULL;
+static size_t arenaWanted = 4096;   // the size for the next single block
+static long arenaAllocations = 0;
+
+static ArenaBlock *new_block(ArenaBlock *previous, size_t size) {
+	ArenaBlock *block = (ArenaBlock*)malloc(offsetof(ArenaBlock, data) + size);
+	if (!block)
+		return NULL;
+	arenaAllocations++;
+	block->previous = previous;
+	block->start = previous ? previous->start + previous->used : 0;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+void *arena_alloc(size_t bytes) {
+	// bytes of scratch memory, valid until a mark taken before this call
+	// is released. Returns NULL only if the heap is exhausted.
+	void *ret;
+	bytes = (bytes + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+	if (!arena || arena->size - arena->used < bytes) {
+		size_t size = arena ? 2 * arena->size : arenaWanted;
+		ArenaBlock *block;
+		while (size < bytes)
+			size *= 2;
+		if (!(block = new_block(arena, size)))
+			return NULL;
+		arena = block;
+	}
+	ret = (char*)arena->data + arena->used;
+	arena->used += bytes;
+	if (arena->start + arena->used > arenaWanted)
+		arenaWanted = arena->start + arena->used;
+	return ret;
+}
+
+wchar_t *arena_wcsdup(const wchar_t *s) {
+	size_t length = wcslen(s);
+	wchar_t *ret = (wchar_t*)arena_alloc((length + 1) * sizeof(wchar_t));
+	if (ret)
+		wmemcpy(ret, s, length + 1);
+	return ret;
+}
+
+char *arena_wc2c(const wchar_t *wc) {
+	// Like wc2c, but the UTF-8 string is in the arena.
+	size_t length = wcslen(wc);
+	char *cret = (char*)arena_alloc(transcode_utf8Length(wc, length) + 1);
+	if (cret)
+		transcode_toUtf8(cret, wc, length);
+	return cret;
+}
+
+size_t arena_mark() {
+	return arena ? arena->start + arena->used : 0;
+}
+
+void arena_release(size_t mark) {
+	// Give back everything allocated since the mark was taken.
+	while (arena && arena->previous && arena->start >= mark) {
+		ArenaBlock *previous = arena->previous;
+		free(arena);
+		arena = previous;
+	}
+	if (!arena)
+		return;
+	arena->used = mark - arena->start;
+	if (mark == 0 && arena->size < arenaWanted) {
+		free(arena);
+		arena = new_block(NULL, arenaWanted);
+	}
+}
+
+long arena_allocations() {
+	return arenaAllocations;
+}
+
 #ifndef __USE_GNU
 
 // These functions are common extensions but we are compiling
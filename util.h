@@ -1,9 +1,33 @@
 #include <wchar.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 char *wc2c(wchar_t *wc, int doFree);
 
+/* A scratch arena for the strings that pass between Python and Praat while
+ * a command runs: the command line, the command's output or error and the
+ * names of the objects it selects. Take a mark before a command and release
+ * it once the results have been turned into Python objects; everything
+ * allocated in between is then reused by the next command. Marks nest, so a
+ * command can run a script that runs commands of its own. arena_allocations
+ * counts the times the arena had to go to the heap, which stops happening
+ * once it has grown to fit the commands a script runs. */
+void *arena_alloc(size_t bytes);
+wchar_t *arena_wcsdup(const wchar_t *s);
+char *arena_wc2c(const wchar_t *wc);
+size_t arena_mark();
+void arena_release(size_t mark);
+long arena_allocations();
+
 #ifndef __USE_GNU
 //char *strdup(const char *s);
 wchar_t *wcsdup(const wchar_t *s);
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+